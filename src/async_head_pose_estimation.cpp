@@ -0,0 +1,123 @@
+#include "async_head_pose_estimation.hpp"
+
+using namespace std;
+
+AsyncHeadPoseEstimation::AsyncHeadPoseEstimation(const HeadPoseEstimation& prototype,
+                                                 size_t queue_size,
+                                                 DropPolicy policy) :
+    queue_size(max<size_t>(queue_size, 1)),
+    policy(policy),
+    stopping(false),
+    nb_submitted(0),
+    nb_dropped(0)
+{
+    pipeline.reset(new PipelineExecutor(prototype,
+                                        [this](PipelineFrame& frame) {return nextFrame(frame);},
+                                        [this](PipelineFrame& frame) {frameDone(frame);}));
+}
+
+AsyncHeadPoseEstimation::~AsyncHeadPoseEstimation()
+{
+    {
+        lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+    pipeline.reset(); // waits for the pending frames
+}
+
+future<AsyncResult> AsyncHeadPoseEstimation::submit(const cv::Mat& frame, double timestamp)
+{
+    unique_ptr<Job> job(new Job);
+    job->frame = frame.clone();
+    job->timestamp = timestamp;
+    auto result = job->promise.get_future();
+    enqueue(move(job));
+    return result;
+}
+
+void AsyncHeadPoseEstimation::submit(const cv::Mat& frame, double timestamp, const Callback& callback)
+{
+    unique_ptr<Job> job(new Job);
+    job->frame = frame.clone();
+    job->timestamp = timestamp;
+    job->callback = callback;
+    enqueue(move(job));
+}
+
+void AsyncHeadPoseEstimation::enqueue(unique_ptr<Job> job)
+{
+    job->frame_idx = nb_submitted++;
+
+    unique_ptr<Job> dropped;
+    {
+        lock_guard<std::mutex> lock(mutex);
+        if (pending.size() < queue_size) {
+            pending.push_back(move(job));
+        }
+        else if (policy == DROP_OLDEST) {
+            dropped = move(pending.front());
+            pending.pop_front();
+            pending.push_back(move(job));
+        }
+        else {
+            dropped = move(job);
+        }
+    }
+    condition.notify_one();
+
+    // outside of the lock: the callback might take a while
+    if (dropped) {
+        ++nb_dropped;
+        AsyncResult result;
+        result.dropped = true;
+        complete(*dropped, result);
+    }
+}
+
+void AsyncHeadPoseEstimation::complete(Job& job, AsyncResult& result)
+{
+    result.frame_idx = job.frame_idx;
+    result.timestamp = job.timestamp;
+    if (job.callback) job.callback(result);
+    else job.promise.set_value(move(result));
+}
+
+bool AsyncHeadPoseEstimation::nextFrame(PipelineFrame& frame)
+{
+    unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [this] {return stopping || !pending.empty();});
+    if (pending.empty()) return false; // stopping, and nothing left to do
+
+    frame.image = pending.front()->frame;
+    frame.timestamp = pending.front()->timestamp;
+    in_flight.push_back(move(pending.front()));
+    pending.pop_front();
+    return true;
+}
+
+void AsyncHeadPoseEstimation::frameDone(PipelineFrame& frame)
+{
+    unique_ptr<Job> job;
+    {
+        lock_guard<std::mutex> lock(mutex);
+        job = move(in_flight.front()); // the pipeline keeps the order
+        in_flight.pop_front();
+    }
+
+    AsyncResult result;
+    result.dropped = false;
+    result.faces = move(frame.faces);
+    result.scores = move(frame.scores);
+    result.features = move(frame.features);
+    result.poses = move(frame.poses);
+    complete(*job, result);
+}
+
+bool AsyncHeadPoseEstimation::parseDropPolicy(const string& name, DropPolicy& policy)
+{
+    if (name == "oldest") policy = DROP_OLDEST;
+    else if (name == "newest") policy = DROP_NEWEST;
+    else return false;
+    return true;
+}
@@ -0,0 +1,126 @@
+#ifndef __ASYNC_HEAD_POSE_ESTIMATION
+#define __ASYNC_HEAD_POSE_ESTIMATION
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+#include "head_pose_estimation.hpp"
+#include "pipeline_executor.hpp"
+
+/** Results of one frame submitted to AsyncHeadPoseEstimation.
+ */
+struct AsyncResult {
+    uint64_t frame_idx; // index of the frame among the submitted ones
+    double timestamp;
+    bool dropped; // the frame was dropped (queue full): no results
+    std::vector<cv::Rect> faces;
+    std::vector<double> scores; // detection confidence of the faces
+    std::vector<std::vector<cv::Point>> features;
+    std::vector<head_pose> poses;
+};
+
+/** Asynchronous head pose estimation, so that the capture loop does not
+ * wait for the inference:
+ *
+ *     AsyncHeadPoseEstimation estimator(HeadPoseEstimation(model));
+ *
+ *     while (video.read(frame)) {
+ *         estimator.submit(frame, timestamp, [](const AsyncResult& result) {...});
+ *     }
+ *
+ * The frames are processed by a PipelineExecutor (see
+ * pipeline_executor.hpp): the faces of frame N+2 are detected while the
+ * features of frame N+1 are fitted and the poses of frame N computed, each
+ * stage with its own thread (and estimator, sharing the model of
+ * `prototype`).
+ *
+ * At most `queue_size` frames wait for the detection. When the queue is
+ * full, the oldest waiting frame (DROP_OLDEST: lowest latency), or the
+ * submitted frame (DROP_NEWEST: regular sampling of the oldest frames) is
+ * dropped. Dropped frames still get their result, with `dropped` set.
+ *
+ * The results of the processed frames are delivered in submission order
+ * (those of the dropped frames, as soon as they are dropped).
+ */
+class AsyncHeadPoseEstimation {
+
+public:
+
+    enum DropPolicy {DROP_OLDEST, DROP_NEWEST};
+
+    typedef std::function<void(const AsyncResult&)> Callback;
+
+    AsyncHeadPoseEstimation(const HeadPoseEstimation& prototype,
+                            size_t queue_size = 2,
+                            DropPolicy policy = DROP_OLDEST);
+
+    /** Waits for the frames already submitted to be processed.
+     */
+    ~AsyncHeadPoseEstimation();
+
+    AsyncHeadPoseEstimation(const AsyncHeadPoseEstimation&) = delete;
+    AsyncHeadPoseEstimation& operator=(const AsyncHeadPoseEstimation&) = delete;
+
+    /** Queues a (BGR) frame. The frame is copied: the caller can reuse it
+     * right away.
+     */
+    std::future<AsyncResult> submit(const cv::Mat& frame, double timestamp = 0);
+
+    /** Same as above, but calls `callback` with the results instead (from
+     * the estimation thread, or from submit() if the frame is dropped).
+     */
+    void submit(const cv::Mat& frame, double timestamp, const Callback& callback);
+
+    uint64_t nbSubmitted() const {return nb_submitted;}
+    uint64_t nbDropped() const {return nb_dropped;}
+
+    /** Occupancy of the pipeline stages.
+     */
+    PipelineStats stats() const {return pipeline->stats();}
+
+    /** Parses a drop policy name ("oldest" or "newest"). Returns false if
+     * unknown.
+     */
+    static bool parseDropPolicy(const std::string& name, DropPolicy& policy);
+
+private:
+
+    struct Job {
+        uint64_t frame_idx;
+        cv::Mat frame;
+        double timestamp;
+        std::promise<AsyncResult> promise;
+        Callback callback;
+    };
+
+    void enqueue(std::unique_ptr<Job> job);
+
+    static void complete(Job& job, AsyncResult& result);
+
+    /** Source and sink of the pipeline.
+     */
+    bool nextFrame(PipelineFrame& frame);
+    void frameDone(PipelineFrame& frame);
+
+    size_t queue_size;
+    DropPolicy policy;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<std::unique_ptr<Job>> pending;   // waiting for the detection
+    std::deque<std::unique_ptr<Job>> in_flight; // in the pipeline, in order
+    bool stopping;
+
+    std::atomic<uint64_t> nb_submitted, nb_dropped;
+
+    std::unique_ptr<PipelineExecutor> pipeline;
+};
+
+#endif // __ASYNC_HEAD_POSE_ESTIMATION
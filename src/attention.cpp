@@ -0,0 +1,333 @@
+#include <cmath>
+#include <algorithm>
+#include <numeric>
+#include <limits>
+
+#include "attention.hpp"
+
+using namespace std;
+
+/** Returns true if the sphere of center v (relative to the apex of the cone)
+ * and radius r intersects the cone of main axis a (unit vector) and
+ * half-aperture given by its cosine and sine.
+ */
+static inline bool intersectsCone(float vx, float vy, float vz, float r,
+                                  float ax, float ay, float az,
+                                  float cos_half_fov, float sin_half_fov)
+{
+    const float along = vx * ax + vy * ay + vz * az;
+    const float distance2 = vx * vx + vy * vy + vz * vz;
+    const float distance_to_main_axis = sqrt(max(distance2 - along * along, 0.f));
+
+    // distance from the center of the sphere to the surface of the cone
+    // (negative if the center is inside the cone)
+    const float distance_to_cone = distance_to_main_axis * cos_half_fov - along * sin_half_fov;
+
+    // if the sphere is behind the observer, the closest point of the cone is its apex
+    const bool behind = along * cos_half_fov + distance_to_main_axis * sin_half_fov < 0;
+
+    return (distance_to_cone < r) & (!behind | (distance2 < r * r));
+}
+
+void Observers::add(float px, float py, float pz, float ax, float ay, float az)
+{
+    float norm = sqrt(ax * ax + ay * ay + az * az);
+    if (norm == 0) norm = 1;
+
+    x.push_back(px); y.push_back(py); z.push_back(pz);
+    dx.push_back(ax / norm); dy.push_back(ay / norm); dz.push_back(az / norm);
+}
+
+void Observers::add(const head_pose& pose)
+{
+    add(pose(0,3), pose(1,3), pose(2,3),
+        pose(0,0), pose(1,0), pose(2,0));
+}
+
+void Observers::clear()
+{
+    x.clear(); y.clear(); z.clear();
+    dx.clear(); dy.clear(); dz.clear();
+}
+
+void AttentionTargets::add(const string& name, float px, float py, float pz, float r)
+{
+    names.push_back(name);
+    x.push_back(px); y.push_back(py); z.push_back(pz);
+    radius.push_back(r);
+}
+
+void AttentionTargets::clear()
+{
+    names.clear();
+    x.clear(); y.clear(); z.clear();
+    radius.clear();
+}
+
+bool loadAttentionTargets(const string& filename, AttentionTargets& targets, string& frame)
+{
+    cv::FileStorage fs(filename, cv::FileStorage::READ);
+    if (!fs.isOpened()) return false;
+
+    if (!fs["frame"].empty()) frame = (string) fs["frame"];
+
+    auto nodes = fs["targets"];
+    for (auto it = nodes.begin(); it != nodes.end(); ++it) {
+        auto target = *it;
+        auto position = target["position"];
+        if (position.size() != 3) return false;
+
+        targets.add((string) target["name"],
+                    (float) position[0], (float) position[1], (float) position[2],
+                    (float) target["radius"]);
+    }
+
+    return true;
+}
+
+/** Tests every (observer, target) pair. The targets are given as a structure
+ * of arrays of size nb_targets.
+ */
+static void fieldOfView(const Observers& observers,
+                        const float* tx, const float* ty, const float* tz, const float* tr,
+                        size_t nb_targets,
+                        float fov,
+                        vector<uint8_t>& in_fov)
+{
+    in_fov.resize(observers.size() * nb_targets);
+
+    const float cos_half_fov = cos(fov / 2);
+    const float sin_half_fov = sin(fov / 2);
+
+    for (size_t i = 0; i < observers.size(); ++i) {
+
+        const float ox = observers.x[i], oy = observers.y[i], oz = observers.z[i];
+        const float ax = observers.dx[i], ay = observers.dy[i], az = observers.dz[i];
+
+        uint8_t* row = in_fov.data() + i * nb_targets;
+
+        // branch-free, so that the compiler can vectorise the loop
+        for (size_t j = 0; j < nb_targets; ++j) {
+            row[j] = intersectsCone(tx[j] - ox, ty[j] - oy, tz[j] - oz, tr[j],
+                                    ax, ay, az,
+                                    cos_half_fov, sin_half_fov);
+        }
+    }
+}
+
+void computeFieldOfView(const Observers& observers,
+                        const AttentionTargets& targets,
+                        float fov,
+                        vector<uint8_t>& in_fov)
+{
+    fieldOfView(observers,
+                targets.x.data(), targets.y.data(), targets.z.data(), targets.radius.data(),
+                targets.size(),
+                fov, in_fov);
+}
+
+void computeMutualGaze(const Observers& observers,
+                       float fov,
+                       float head_radius,
+                       vector<uint8_t>& looking_at)
+{
+    const size_t nb_observers = observers.size();
+    const vector<float> radius(nb_observers, head_radius);
+
+    fieldOfView(observers,
+                observers.x.data(), observers.y.data(), observers.z.data(), radius.data(),
+                nb_observers,
+                fov, looking_at);
+
+    // an observer is always inside its own field of view
+    for (size_t i = 0; i < nb_observers; ++i) {
+        looking_at[i * nb_observers + i] = 0;
+    }
+}
+
+AttentionTargetsIndex::AttentionTargetsIndex(const AttentionTargets& targets)
+{
+    build(targets);
+}
+
+void AttentionTargetsIndex::build(const AttentionTargets& targets)
+{
+    nodes.clear();
+
+    x = targets.x; y = targets.y; z = targets.z;
+    radius = targets.radius;
+
+    indices.resize(targets.size());
+    iota(indices.begin(), indices.end(), 0);
+
+    if (indices.empty()) return;
+
+    buildNode(0, indices.size());
+
+    // re-order the targets so that the targets of a leaf are contiguous in memory
+    auto reorder = [this](vector<float>& values) {
+        vector<float> sorted(values.size());
+        for (size_t k = 0; k < indices.size(); ++k) sorted[k] = values[indices[k]];
+        values.swap(sorted);
+    };
+    reorder(x); reorder(y); reorder(z); reorder(radius);
+}
+
+uint32_t AttentionTargetsIndex::buildNode(uint32_t first, uint32_t count)
+{
+    uint32_t node_idx = nodes.size();
+    nodes.push_back(Node());
+
+    // bounding box of the targets
+    float min_corner[3], max_corner[3];
+    fill(min_corner, min_corner + 3, numeric_limits<float>::max());
+    fill(max_corner, max_corner + 3, numeric_limits<float>::lowest());
+
+    for (uint32_t k = first; k < first + count; ++k) {
+        auto i = indices[k];
+        const float center[3] = {x[i], y[i], z[i]};
+        for (size_t axis = 0; axis < 3; ++axis) {
+            min_corner[axis] = min(min_corner[axis], center[axis] - radius[i]);
+            max_corner[axis] = max(max_corner[axis], center[axis] + radius[i]);
+        }
+    }
+
+    Node node;
+    node.x = (min_corner[0] + max_corner[0]) / 2;
+    node.y = (min_corner[1] + max_corner[1]) / 2;
+    node.z = (min_corner[2] + max_corner[2]) / 2;
+    node.radius = 0;
+    for (uint32_t k = first; k < first + count; ++k) {
+        auto i = indices[k];
+        const float dx = x[i] - node.x, dy = y[i] - node.y, dz = z[i] - node.z;
+        node.radius = max(node.radius, sqrt(dx * dx + dy * dy + dz * dz) + radius[i]);
+    }
+
+    if (count <= MAX_TARGETS_PER_LEAF) {
+        node.first = first;
+        node.count = count;
+        nodes[node_idx] = node;
+        return node_idx;
+    }
+
+    // split at the median of the largest dimension of the bounding box
+    size_t split_axis = 0;
+    for (size_t axis = 1; axis < 3; ++axis) {
+        if (max_corner[axis] - min_corner[axis] > max_corner[split_axis] - min_corner[split_axis]) {
+            split_axis = axis;
+        }
+    }
+    const auto& coords = split_axis == 0 ? x : (split_axis == 1 ? y : z);
+
+    const uint32_t half = count / 2;
+    nth_element(indices.begin() + first,
+                indices.begin() + first + half,
+                indices.begin() + first + count,
+                [&coords](size_t a, size_t b) {return coords[a] < coords[b];});
+
+    node.count = 0;
+    nodes[node_idx] = node;
+
+    buildNode(first, half); // left child: node_idx + 1
+    // (building the right child reallocates `nodes`)
+    auto right_child = buildNode(first + half, count - half);
+    nodes[node_idx].first = right_child;
+
+    return node_idx;
+}
+
+void AttentionTargetsIndex::query(const Observers& observers, size_t observer_idx, float fov,
+                                  vector<size_t>& in_fov) const
+{
+    if (nodes.empty()) return;
+
+    const float cos_half_fov = cos(fov / 2);
+    const float sin_half_fov = sin(fov / 2);
+
+    const float ox = observers.x[observer_idx], oy = observers.y[observer_idx], oz = observers.z[observer_idx];
+    const float ax = observers.dx[observer_idx], ay = observers.dy[observer_idx], az = observers.dz[observer_idx];
+
+    uint32_t stack[64];
+    size_t stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while (stack_size > 0) {
+        const auto node_idx = stack[--stack_size];
+        const auto& node = nodes[node_idx];
+
+        if (!intersectsCone(node.x - ox, node.y - oy, node.z - oz, node.radius,
+                            ax, ay, az, cos_half_fov, sin_half_fov)) continue;
+
+        if (node.count > 0) {
+            for (uint32_t k = node.first; k < node.first + node.count; ++k) {
+                if (intersectsCone(x[k] - ox, y[k] - oy, z[k] - oz, radius[k],
+                                   ax, ay, az, cos_half_fov, sin_half_fov)) {
+                    in_fov.push_back(indices[k]);
+                }
+            }
+        }
+        else {
+            stack[stack_size++] = node.first;
+            stack[stack_size++] = node_idx + 1;
+        }
+    }
+}
+
+/** Returns the distance along the ray (origin o, unit direction a) to the
+ * first intersection with the sphere (center c, radius r), 0 if the origin is
+ * inside the sphere, or a negative value if the ray misses the sphere.
+ */
+static inline float intersectsRay(float cx, float cy, float cz, float r,
+                                  float ox, float oy, float oz,
+                                  float ax, float ay, float az)
+{
+    const float vx = cx - ox, vy = cy - oy, vz = cz - oz;
+    const float along = vx * ax + vy * ay + vz * az;
+    const float distance_to_ray2 = vx * vx + vy * vy + vz * vz - along * along;
+
+    if (distance_to_ray2 > r * r) return -1;
+
+    const float half_chord = sqrt(r * r - distance_to_ray2);
+    if (along + half_chord < 0) return -1; // behind the origin
+
+    return max(along - half_chord, 0.f);
+}
+
+int AttentionTargetsIndex::raycast(const Observers& observers, size_t observer_idx, float& distance) const
+{
+    int hit = -1;
+    distance = numeric_limits<float>::max();
+
+    if (nodes.empty()) return hit;
+
+    const float ox = observers.x[observer_idx], oy = observers.y[observer_idx], oz = observers.z[observer_idx];
+    const float ax = observers.dx[observer_idx], ay = observers.dy[observer_idx], az = observers.dz[observer_idx];
+
+    uint32_t stack[64];
+    size_t stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while (stack_size > 0) {
+        const auto node_idx = stack[--stack_size];
+        const auto& node = nodes[node_idx];
+
+        auto d = intersectsRay(node.x, node.y, node.z, node.radius, ox, oy, oz, ax, ay, az);
+        if (d < 0 || d >= distance) continue;
+
+        if (node.count > 0) {
+            for (uint32_t k = node.first; k < node.first + node.count; ++k) {
+                d = intersectsRay(x[k], y[k], z[k], radius[k], ox, oy, oz, ax, ay, az);
+                if (d >= 0 && d < distance) {
+                    distance = d;
+                    hit = indices[k];
+                }
+            }
+        }
+        else {
+            stack[stack_size++] = node.first;
+            stack[stack_size++] = node_idx + 1;
+        }
+    }
+
+    return hit;
+}
@@ -0,0 +1,139 @@
+#ifndef __ATTENTION
+#define __ATTENTION
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "head_pose_estimation.hpp"
+
+/** A set of observers (typically, heads), stored as a structure of arrays so
+ * that the field of view tests can be vectorised.
+ *
+ * Each observer is defined by its position and by the main axis of its field
+ * of view (the X axis of the head frame, as returned by HeadPoseEstimation).
+ */
+struct Observers {
+
+    std::vector<float> x, y, z;
+    std::vector<float> dx, dy, dz; // unit vector of the field of view main axis
+
+    /** Adds an observer. The axis does not need to be normalized.
+     */
+    void add(float px, float py, float pz, float ax, float ay, float az);
+
+    /** Adds an observer from a head pose: the position is the pose's
+     * translation, the main axis its X axis.
+     */
+    void add(const head_pose& pose);
+
+    void clear();
+    size_t size() const {return x.size();}
+};
+
+/** A set of objects that might fall in the field of view of the observers,
+ * stored as a structure of arrays.
+ *
+ * Each target is approximated by a sphere. A radius of 0 makes it a point.
+ */
+struct AttentionTargets {
+
+    std::vector<std::string> names;
+    std::vector<float> x, y, z;
+    std::vector<float> radius;
+
+    void add(const std::string& name, float px, float py, float pz, float r = 0);
+
+    void clear();
+    size_t size() const {return x.size();}
+};
+
+/** Loads a set of targets from a YAML or XML file (as read by cv::FileStorage):
+ *
+ *     frame: map
+ *     targets:
+ *        - { name: shelf_1, position: [1.2, 0.5, 1.0], radius: 0.3 }
+ *        - ...
+ *
+ * `frame` (the reference frame of the positions) is optional. Returns false
+ * if the file can not be read.
+ */
+bool loadAttentionTargets(const std::string& filename, AttentionTargets& targets, std::string& frame);
+
+/** For every (observer, target) pair, tests whether the target lies (even
+ * partially) in the observer's field of view, modeled as a cone of aperture
+ * `fov` (in radians) around the observer's main axis.
+ *
+ * `in_fov` is resized to observers.size() * targets.size() and filled row by
+ * row: in_fov[i * targets.size() + j] is 1 if target j is seen by observer i,
+ * 0 otherwise.
+ */
+void computeFieldOfView(const Observers& observers,
+                        const AttentionTargets& targets,
+                        float fov,
+                        std::vector<uint8_t>& in_fov);
+
+/** Computes the directed "looking-at" graph between observers, each observer
+ * being also a target (a sphere of radius `head_radius` around its position).
+ *
+ * `looking_at` is resized to observers.size()^2: looking_at[i * observers.size() + j]
+ * is 1 if observer j is in the field of view of observer i. The diagonal is
+ * always 0.
+ */
+void computeMutualGaze(const Observers& observers,
+                       float fov,
+                       float head_radius,
+                       std::vector<uint8_t>& looking_at);
+
+/** Bounding volume hierarchy over a static set of attention targets.
+ *
+ * Use it instead of computeFieldOfView() when monitoring many targets: the
+ * cost of a query grows with the logarithm of the number of targets (plus
+ * the number of targets actually in the field of view), instead of linearly.
+ */
+class AttentionTargetsIndex {
+
+public:
+
+    AttentionTargetsIndex() {}
+    explicit AttentionTargetsIndex(const AttentionTargets& targets);
+
+    void build(const AttentionTargets& targets);
+
+    /** Appends to `in_fov` the indices (in the original AttentionTargets) of
+     * the targets in the field of view of the given observer.
+     */
+    void query(const Observers& observers, size_t observer_idx, float fov,
+               std::vector<size_t>& in_fov) const;
+
+    /** Returns the index of the first target hit by the main axis of the
+     * given observer (and sets `distance` to the distance to its surface),
+     * or -1 if the ray does not hit any target.
+     */
+    int raycast(const Observers& observers, size_t observer_idx, float& distance) const;
+
+    size_t size() const {return indices.size();}
+
+private:
+
+    static const size_t MAX_TARGETS_PER_LEAF = 4;
+
+    struct Node {
+        // bounding sphere of all the targets below that node
+        float x, y, z, radius;
+        // leaf: range [first, first + count) of the targets.
+        // internal node (count == 0): the left child is the next node,
+        // `first` is the index of the right child.
+        uint32_t first, count;
+    };
+
+    uint32_t buildNode(uint32_t first, uint32_t count);
+
+    std::vector<Node> nodes;
+
+    // the targets, re-ordered so that the targets of each leaf are contiguous
+    std::vector<float> x, y, z, radius;
+    std::vector<size_t> indices; // original index of each target
+};
+
+#endif // __ATTENTION
@@ -0,0 +1,109 @@
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <algorithm>
+
+#include "attention_heatmap.hpp"
+
+using namespace std;
+
+// voxel coordinates are packed on 21 bits each (signed), ie +/-100km with 10cm voxels
+static const int VOXEL_BITS = 21;
+static const int64_t VOXEL_OFFSET = 1 << (VOXEL_BITS - 1);
+static const uint64_t VOXEL_MASK = (1 << VOXEL_BITS) - 1;
+
+static inline uint64_t packVoxel(int64_t i, int64_t j, int64_t k)
+{
+    return (uint64_t((i + VOXEL_OFFSET) & VOXEL_MASK) << (2 * VOXEL_BITS)) |
+           (uint64_t((j + VOXEL_OFFSET) & VOXEL_MASK) << VOXEL_BITS) |
+            uint64_t((k + VOXEL_OFFSET) & VOXEL_MASK);
+}
+
+static inline void unpackVoxel(uint64_t key, int64_t& i, int64_t& j, int64_t& k)
+{
+    i = int64_t((key >> (2 * VOXEL_BITS)) & VOXEL_MASK) - VOXEL_OFFSET;
+    j = int64_t((key >> VOXEL_BITS) & VOXEL_MASK) - VOXEL_OFFSET;
+    k = int64_t(key & VOXEL_MASK) - VOXEL_OFFSET;
+}
+
+/** Writes to a temporary file through `write`, then renames it to `filename`.
+ */
+template<typename Writer>
+static bool writeAtomically(const string& filename, Writer write)
+{
+    const string tmp_filename = filename + ".tmp";
+    {
+        ofstream file(tmp_filename);
+        if (!file.is_open()) return false;
+        write(file);
+        file.close(); // flushes: might fail too (eg, disk full)
+        if (!file) {
+            remove(tmp_filename.c_str());
+            return false;
+        }
+    }
+    return rename(tmp_filename.c_str(), filename.c_str()) == 0;
+}
+
+AttentionHeatmap::AttentionHeatmap(float voxel_size, double max_frame_interval) :
+        voxel_size(voxel_size),
+        max_frame_interval(max_frame_interval),
+        last_timestamp(-1)
+{
+}
+
+double AttentionHeatmap::frameDuration(double timestamp)
+{
+    double duration = 0;
+    if (last_timestamp >= 0) {
+        duration = min(max(timestamp - last_timestamp, 0.), max_frame_interval);
+    }
+    last_timestamp = timestamp;
+    return duration;
+}
+
+void AttentionHeatmap::addDwell(const string& observer, const string& target, double duration)
+{
+    dwell_times[observer][target] += duration;
+}
+
+void AttentionHeatmap::addGazePoint(float x, float y, float z, double duration)
+{
+    voxels[packVoxel(floor(x / voxel_size),
+                     floor(y / voxel_size),
+                     floor(z / voxel_size))] += duration;
+}
+
+bool AttentionHeatmap::exportDwellTimes(const string& filename) const
+{
+    return writeAtomically(filename, [this](ofstream& file) {
+        file << "observer,target,seconds\n";
+        for (const auto& observer : dwell_times) {
+            for (const auto& target : observer.second) {
+                file << observer.first << "," << target.first << "," << target.second << "\n";
+            }
+        }
+    });
+}
+
+bool AttentionHeatmap::exportVoxels(const string& filename) const
+{
+    return writeAtomically(filename, [this](ofstream& file) {
+        file << "x,y,z,seconds\n";
+        for (const auto& voxel : voxels) {
+            int64_t i, j, k;
+            unpackVoxel(voxel.first, i, j, k);
+            file << (i + 0.5) * voxel_size << ","
+                 << (j + 0.5) * voxel_size << ","
+                 << (k + 0.5) * voxel_size << ","
+                 << voxel.second << "\n";
+        }
+    });
+}
+
+void AttentionHeatmap::clear()
+{
+    dwell_times.clear();
+    voxels.clear();
+    last_timestamp = -1;
+}
@@ -0,0 +1,68 @@
+#ifndef __ATTENTION_HEATMAP
+#define __ATTENTION_HEATMAP
+
+#include <string>
+#include <cstdint>
+#include <unordered_map>
+
+/** Accumulates over time where the observers have been looking, both as a
+ * dwell time per (observer, target) pair and as a sparse 3D grid of voxels
+ * containing the gaze points.
+ *
+ * All the updates are O(1) (amortised), so the heat map can be updated at
+ * every frame, and exported periodically.
+ */
+class AttentionHeatmap {
+
+public:
+
+    /** voxel_size: size of the voxels, in metres
+     *  max_frame_interval: maximum duration (in seconds) attributed to a
+     *  frame, so that the time during which no face is visible is not
+     *  accounted for.
+     */
+    AttentionHeatmap(float voxel_size = 0.1, double max_frame_interval = 0.5);
+
+    /** Returns the duration to attribute to the frame at `timestamp` (in
+     * seconds): the time elapsed since the previous frame, capped to
+     * max_frame_interval. Returns 0 for the first frame.
+     */
+    double frameDuration(double timestamp);
+
+    /** Adds `duration` seconds of attention of `observer` to `target`.
+     */
+    void addDwell(const std::string& observer, const std::string& target, double duration);
+
+    /** Adds `duration` seconds of attention to the voxel containing the
+     * point (x, y, z).
+     */
+    void addGazePoint(float x, float y, float z, double duration);
+
+    /** Writes the dwell times as CSV (observer,target,seconds). The file is
+     * written aside and then renamed, so that readers never see a partial
+     * snapshot. Returns false on failure.
+     */
+    bool exportDwellTimes(const std::string& filename) const;
+
+    /** Writes the non-empty voxels as CSV (x,y,z,seconds), x, y, z being the
+     * centre of the voxel. Same guarantees as exportDwellTimes().
+     */
+    bool exportVoxels(const std::string& filename) const;
+
+    void clear();
+
+    float voxel_size;
+    double max_frame_interval;
+
+private:
+
+    // observer -> target -> seconds
+    std::unordered_map<std::string, std::unordered_map<std::string, double>> dwell_times;
+
+    // packed voxel coordinates -> seconds
+    std::unordered_map<uint64_t, double> voxels;
+
+    double last_timestamp;
+};
+
+#endif // __ATTENTION_HEATMAP
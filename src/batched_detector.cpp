@@ -0,0 +1,110 @@
+#include "batched_detector.hpp"
+
+using namespace std;
+
+BatchedDetector::BatchedDetector(const BatchFunction& detect_batch, size_t batch_size, double max_wait) :
+    detect_batch(detect_batch),
+    batch_size(max<size_t>(batch_size, 1)),
+    max_wait(max(max_wait, 0.)),
+    running(false),
+    nb_batches(0),
+    nb_images(0),
+    total_wait(0),
+    total_batch_time(0)
+{
+}
+
+vector<cv::Rect> BatchedDetector::detect(const cv::Mat& image)
+{
+    Request request;
+    request.image = image;
+    request.submitted = Clock::now();
+    request.done = false;
+
+    const auto max_wait_duration = chrono::duration_cast<Clock::duration>(chrono::duration<double>(max_wait));
+
+    unique_lock<std::mutex> lock(mutex);
+    pending.push_back(&request);
+    condition.notify_all(); // might complete a batch
+
+    while (!request.done) {
+        if (running) {
+            condition.wait(lock);
+            continue;
+        }
+
+        const auto oldest_deadline = pending.front()->submitted + max_wait_duration;
+        if (pending.size() >= batch_size || Clock::now() >= oldest_deadline) {
+            runBatch(lock);
+        }
+        else {
+            condition.wait_until(lock, oldest_deadline);
+        }
+    }
+
+    if (request.error) rethrow_exception(request.error);
+    return move(request.faces);
+}
+
+void BatchedDetector::runBatch(unique_lock<std::mutex>& lock)
+{
+    // the oldest request, and the next ones of the same size
+    vector<Request*> batch;
+    for (auto it = pending.begin(); it != pending.end() && batch.size() < batch_size;) {
+        if ((*it)->image.size() == pending.front()->image.size()) {
+            batch.push_back(*it);
+            it = pending.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+
+    vector<cv::Mat> images;
+    for (auto request : batch) images.push_back(request->image);
+
+    running = true;
+    const auto start = Clock::now();
+    lock.unlock();
+
+    // if the batch fails (eg, out of memory), its requests fail with the same
+    // error, and the others go on
+    vector<vector<cv::Rect>> faces;
+    exception_ptr error;
+    try {
+        faces = detect_batch(images);
+    }
+    catch (...) {
+        error = current_exception();
+    }
+
+    lock.lock();
+    running = false;
+    const auto end = Clock::now();
+
+    for (size_t i = 0; i < batch.size(); ++i) {
+        if (i < faces.size()) batch[i]->faces = move(faces[i]);
+        batch[i]->error = error;
+        batch[i]->done = true;
+        total_wait += chrono::duration<double>(start - batch[i]->submitted).count();
+    }
+    ++nb_batches;
+    nb_images += batch.size();
+    total_batch_time += chrono::duration<double>(end - start).count();
+
+    condition.notify_all();
+}
+
+BatchStats BatchedDetector::stats() const
+{
+    lock_guard<std::mutex> lock(mutex);
+
+    BatchStats stats;
+    stats.nb_batches = nb_batches;
+    stats.nb_images = nb_images;
+    stats.batch_size = nb_batches > 0 ? double(nb_images) / nb_batches : 0;
+    stats.wait = nb_images > 0 ? total_wait / nb_images : 0;
+    stats.batch_time = nb_batches > 0 ? total_batch_time / nb_batches : 0;
+    stats.images_per_second = total_batch_time > 0 ? nb_images / total_batch_time : 0;
+    return stats;
+}
@@ -0,0 +1,89 @@
+#ifndef __BATCHED_DETECTOR
+#define __BATCHED_DETECTOR
+
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+
+#include <opencv2/core/core.hpp>
+
+/** Throughput and latency of a BatchedDetector, since it was created.
+ */
+struct BatchStats {
+    uint64_t nb_batches;
+    uint64_t nb_images;
+    double batch_size;    // average number of images per batch
+    double wait;          // average time an image waited for its batch to start, in seconds
+    double batch_time;    // average duration of a batch, in seconds
+    double images_per_second; // while detecting
+};
+
+/** Groups the detection requests of several threads (typically, the
+ * workers of a MultiStreamRuntime serving several cameras) into batches,
+ * for detectors that are much more efficient on a batch of images than on
+ * one image at a time (eg, the CNN detector, see cnn_face_detector.hpp).
+ *
+ * A batch starts when `batch_size` images are waiting, or when the oldest
+ * one has waited `max_wait` seconds: larger batches and longer waits raise
+ * the throughput, at the expense of the latency (see stats()). Only images
+ * of the same size are batched together; one batch runs at a time, by the
+ * thread whose request triggered it.
+ */
+class BatchedDetector {
+
+public:
+
+    /** Detects the faces in each image of a batch (all of the same size).
+     */
+    typedef std::function<std::vector<std::vector<cv::Rect>>(const std::vector<cv::Mat>&)> BatchFunction;
+
+    BatchedDetector(const BatchFunction& detect_batch, size_t batch_size = 4, double max_wait = 0.01);
+
+    BatchedDetector(const BatchedDetector&) = delete;
+    BatchedDetector& operator=(const BatchedDetector&) = delete;
+
+    /** Detects the faces of the image, in a batch with the images of the
+     * other threads. Blocks until done. Thread-safe. If the batch function
+     * throws, the exception is rethrown to all the callers of the batch.
+     */
+    std::vector<cv::Rect> detect(const cv::Mat& image);
+
+    BatchStats stats() const;
+
+    size_t batchSize() const {return batch_size;}
+    double maxWait() const {return max_wait;}
+
+private:
+
+    typedef std::chrono::steady_clock Clock;
+
+    struct Request {
+        cv::Mat image;
+        Clock::time_point submitted;
+        std::vector<cv::Rect> faces;
+        bool done;
+        std::exception_ptr error; // thrown by the batch function
+    };
+
+    /** Runs the next batch (the lock is released meanwhile).
+     */
+    void runBatch(std::unique_lock<std::mutex>& lock);
+
+    BatchFunction detect_batch;
+    size_t batch_size;
+    double max_wait;
+
+    mutable std::mutex mutex;
+    std::condition_variable condition;
+    std::vector<Request*> pending; // in submission order
+    bool running;
+
+    uint64_t nb_batches, nb_images;
+    double total_wait, total_batch_time;
+};
+
+#endif // __BATCHED_DETECTOR
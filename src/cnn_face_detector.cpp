@@ -0,0 +1,78 @@
+#include <map>
+
+#include <opencv2/core/types_c.h>  // cvIplImage
+#include <dlib/dnn.h>
+#include <dlib/opencv.h>
+
+#include "cnn_face_detector.hpp"
+
+using namespace std;
+using namespace dlib;
+
+// the network of dlib's dnn_mmod_face_detection_ex.cpp example, that
+// mmod_human_face_detector.dat was trained with
+template <long num_filters, typename SUBNET> using con5d = con<num_filters,5,5,2,2,SUBNET>;
+template <long num_filters, typename SUBNET> using con5  = con<num_filters,5,5,1,1,SUBNET>;
+
+template <typename SUBNET> using downsampler  = relu<affine<con5d<32, relu<affine<con5d<32, relu<affine<con5d<16,SUBNET>>>>>>>>>;
+template <typename SUBNET> using rcon5  = relu<affine<con5<45,SUBNET>>>;
+
+typedef loss_mmod<con<1,9,9,1,1,rcon5<rcon5<rcon5<downsampler<input_rgb_image_pyramid<pyramid_down<6>>>>>>>> mmod_net;
+
+struct CnnFaceDetector::Network {
+    mmod_net net;
+};
+
+static matrix<rgb_pixel> toDlib(const cv::Mat& image)
+{
+    // intermediate value to avoid potential compilation error:
+    //     conversion from ‘const cv::Mat’ to non-scalar type ‘IplImage’
+    auto ipl_img = cvIplImage(image);
+    matrix<rgb_pixel> result;
+    assign_image(result, cv_image<bgr_pixel>(&ipl_img));
+    return result;
+}
+
+static cv::Rect toCv(const dlib::rectangle& r)
+{
+    return cv::Rect(r.left(), r.top(), r.width(), r.height());
+}
+
+CnnFaceDetector::CnnFaceDetector(const string& model) :
+    network(new Network)
+{
+    deserialize(model) >> network->net;
+}
+
+CnnFaceDetector::~CnnFaceDetector()
+{
+}
+
+std::vector<cv::Rect> CnnFaceDetector::detect(const cv::Mat& image)
+{
+    return detect(std::vector<cv::Mat>(1, image))[0];
+}
+
+std::vector<std::vector<cv::Rect>> CnnFaceDetector::detect(const std::vector<cv::Mat>& images)
+{
+    // the images of a forward pass must have the same size
+    map<pair<int, int>, std::vector<size_t>> by_size;
+    for (size_t i = 0; i < images.size(); ++i) {
+        by_size[make_pair(images[i].cols, images[i].rows)].push_back(i);
+    }
+
+    std::vector<std::vector<cv::Rect>> faces(images.size());
+    for (const auto& group : by_size) {
+        std::vector<matrix<rgb_pixel>> batch;
+        for (auto i : group.second) batch.push_back(toDlib(images[i]));
+
+        auto detections = network->net(batch, batch.size());
+
+        for (size_t j = 0; j < group.second.size(); ++j) {
+            for (const auto& detection : detections[j]) {
+                faces[group.second[j]].push_back(toCv(detection.rect));
+            }
+        }
+    }
+    return faces;
+}
@@ -0,0 +1,46 @@
+#ifndef __CNN_FACE_DETECTOR
+#define __CNN_FACE_DETECTOR
+
+#include <vector>
+#include <string>
+#include <memory>
+
+#include <opencv2/core/core.hpp>
+
+/** dlib's CNN face detector (max-margin object detection, trained on
+ * `mmod_human_face_detector.dat`, available from dlib.net). More accurate
+ * than the default HOG detector (in particular, on non-frontal faces), but
+ * much slower on CPU, unless the images are processed in batches.
+ *
+ * Only available if gazr is compiled with WITH_CNN_DETECTOR.
+ *
+ * A detector is not thread-safe: share it between threads with a
+ * BatchedDetector (see batched_detector.hpp).
+ */
+class CnnFaceDetector {
+
+public:
+
+    CnnFaceDetector(const std::string& model = "mmod_human_face_detector.dat");
+
+    ~CnnFaceDetector();
+
+    CnnFaceDetector(const CnnFaceDetector&) = delete;
+    CnnFaceDetector& operator=(const CnnFaceDetector&) = delete;
+
+    /** Detects the faces in a (BGR) image.
+     */
+    std::vector<cv::Rect> detect(const cv::Mat& image);
+
+    /** Detects the faces in a batch of (BGR) images, in a single forward
+     * pass per image size.
+     */
+    std::vector<std::vector<cv::Rect>> detect(const std::vector<cv::Mat>& images);
+
+private:
+
+    struct Network;
+    std::unique_ptr<Network> network;
+};
+
+#endif // __CNN_FACE_DETECTOR
@@ -1,6 +1,7 @@
 #include <string>
 #include <vector>
 #include <sstream>
+#include <algorithm>
 
 #include <ros/ros.h>
 #include <visualization_msgs/Marker.h>
@@ -8,6 +9,11 @@
 #include <std_msgs/ColorRGBA.h>
 #include <std_msgs/String.h>
 #include <tf/transform_listener.h>
+#include <tf2_msgs/TFMessage.h>
+
+#include "attention.hpp"
+#include "scene_mesh.hpp"
+#include "attention_heatmap.hpp"
 
 using namespace std;
 
@@ -16,13 +22,25 @@ static const string HUMAN_FRAME_PREFIX = "face_";
 static const double FOV = 20. / 180 * M_PI; // radians
 static const float RANGE = 3; //m
 
+// faces are approximated by spheres of that radius when testing whether
+// someone is looking at someone else
+static const float HEAD_RADIUS = 0.1; //m
+
+// head poses older than that are discarded, to bound the latency of the
+// focus estimation when the node can not keep up
+static const double MAX_LATENCY = 0.2; // s
+
+// if no head pose is received for that long, the fields of view are hidden
+static const double FACE_TIMEOUT = 0.5; // s
+
 std::vector<std_msgs::ColorRGBA> colors;
 static std_msgs::ColorRGBA GREEN;
 static std_msgs::ColorRGBA BLUE;
 static std_msgs::ColorRGBA RED;
 
 
-visualization_msgs::Marker makeMarker(int id, const string& frame, std_msgs::ColorRGBA color) {
+visualization_msgs::Marker makeMarker(int id, const string& frame, std_msgs::ColorRGBA color,
+                                      double x = 0, double y = 0, double z = 0, double size = 0.04) {
 
     visualization_msgs::Marker marker;
     // Set the frame ID and timestamp.  See the TF tutorials for information on these.
@@ -40,17 +58,17 @@ visualization_msgs::Marker makeMarker(int id, const string& frame, std_msgs::Col
     marker.action = visualization_msgs::Marker::ADD;
 
     // Set the pose of the marker.  This is a full 6DOF pose relative to the frame/time specified in the header
-    marker.pose.position.x = 0;
-    marker.pose.position.y = 0;
-    marker.pose.position.z = 0;
+    marker.pose.position.x = x;
+    marker.pose.position.y = y;
+    marker.pose.position.z = z;
     marker.pose.orientation.x = 0.0;
     marker.pose.orientation.y = 0.0;
     marker.pose.orientation.z = 0.0;
     marker.pose.orientation.w = 1.0;
 
-    marker.scale.x = 0.04;
-    marker.scale.y = 0.04;
-    marker.scale.z = 0.04;
+    marker.scale.x = size;
+    marker.scale.y = size;
+    marker.scale.z = size;
 
     marker.color = color;
 
@@ -59,133 +77,497 @@ visualization_msgs::Marker makeMarker(int id, const string& frame, std_msgs::Col
     return marker;
 }
 
-bool isInFieldOfView(const tf::TransformListener& listener, const string& target_frame, const string& observer_frame) {
+/**
+ * Estimates the focus of attention of every detected face each time a new
+ * set of head poses is broadcast on TF.
+ *
+ * gazr broadcasts all the faces detected in a given image in a single TF
+ * message, relative to the camera frame. The monitored frames are therefore
+ * looked up once per image (and not once per face), and the field of view of
+ * all the faces is then tested against all the monitored frames at once.
+ *
+ * Static targets (like shelves or screens) can be monitored as well. They are
+ * stored in a bounding volume hierarchy, so that hundreds of them can be
+ * monitored at a cost logarithmic in their number.
+ *
+ * Finally, if a mesh of the environment is provided, the head direction of
+ * each face is intersected with it, to find out what is being looked at.
+ *
+ * Optionally, all of this is accumulated over time in an attention heat map
+ * (dwell time per face and target, and gaze points in a voxel grid), that is
+ * periodically exported to CSV files.
+ */
+class FocusOfAttentionEstimator {
 
-    tf::StampedTransform transform;
+public:
+    FocusOfAttentionEstimator(ros::NodeHandle& rosNode,
+                              const vector<string>& monitored_frames);
 
-    try{
-        listener.lookupTransform(observer_frame, target_frame, ros::Time(0), transform);
-    }
-    catch (tf::TransformException ex){
-        ROS_ERROR("%s",ex.what());
-        ros::Duration(1.0).sleep();
-    }
+    void setStaticTargets(const AttentionTargets& targets, const string& frame);
 
-    // object behind the observer?
-    if (transform.getOrigin().x() < 0) return false;
+    /** Loads the mesh of the environment (a Wavefront OBJ file), expressed
+     * in the given frame. Returns false if the mesh can not be loaded.
+     */
+    bool loadScene(const string& filename, const string& frame);
 
-    // the field of view's main axis is the observer's X axis. So, distance to main axis is
-    // simply sqrt(y^2 + z^2)
-    double distance_to_main_axis = sqrt(transform.getOrigin().y() * transform.getOrigin().y() + transform.getOrigin().z() * transform.getOrigin().z());
+    /** Starts accumulating the attention heat map, and exports it every
+     * `period` seconds to <prefix>_dwell.csv and <prefix>_voxels.csv.
+     */
+    void enableHeatmap(ros::NodeHandle& rosNode, const string& prefix, double period, float voxel_size);
 
-    double fov_radius_at_x = tan(FOV/2) * transform.getOrigin().x();
+private:
 
-    //ROS_INFO_STREAM(target_frame << ": distance_to_main_axis: " << distance_to_main_axis << ", fov_radius_at_x: " << fov_radius_at_x);
-    if (distance_to_main_axis < fov_radius_at_x) return true;
+    void onHeatmapExport(const ros::TimerEvent& event);
 
-    return false;
+    /** Expresses the faces (in the camera frame) in the given frame.
+     */
+    bool transformFaces(const string& camera_frame, const string& frame, Observers& transformed_faces);
 
-}
+    void publishGazeHits(const string& camera_frame, const ros::Time& stamp);
 
-int main( int argc, char** argv )
-{
-    GREEN.r = 0.; GREEN.g = 1.; GREEN.b = 0.; GREEN.a = 1.;
-    BLUE.r = 0.; BLUE.g = 0.; BLUE.b = 1.; BLUE.a = 1.;
-    RED.r = 1.; RED.g = 0.; RED.b = 0.; RED.a = 1.;
-    colors.push_back(GREEN);
-    colors.push_back(BLUE);
-    colors.push_back(RED);
+    void onTf(const tf2_msgs::TFMessageConstPtr& msg);
 
-    ros::init(argc, argv, "estimate_focus");
-    ros::NodeHandle n;
-    ros::Rate r(30);
-    ros::Publisher marker_pub = n.advertise<visualization_msgs::Marker>("estimate_focus", 1);
-    ros::Publisher fov_pub = n.advertise<sensor_msgs::Range>("face_0_field_of_view", 1);
-    ros::Publisher frames_in_fov_pub = n.advertise<std_msgs::String>("actual_focus_of_attention", 1);
+    void onWatchdog(const ros::TimerEvent& event);
+
+    void hideFieldOfView(const string& face_frame);
+
+    void publishMutualGaze(const string& camera_frame, const ros::Time& stamp);
 
     tf::TransformListener listener;
-    vector<string> frames;
 
-    vector<string> monitored_frames = {"/robot_head", "/tablet", "/selection_tablet", "/experimenter"};
+    ros::Subscriber tf_sub;
+    ros::Timer watchdog;
 
+    ros::Publisher marker_pub;
+    ros::Publisher fov_pub;
+    ros::Publisher frames_in_fov_pub;
+    ros::Publisher mutual_gaze_pub;
+    ros::Publisher gaze_hits_pub;
+
+    vector<string> monitored_frames;
+
+    // faces of the TF message being processed
+    vector<string> face_frames;
+    Observers faces;
+
+    // faces whose field of view is currently displayed
+    vector<string> visible_faces;
+
+    // monitored frames that could be looked up, expressed in the camera frame
+    AttentionTargets targets;
+    vector<size_t> target_ids;
+
+    vector<uint8_t> in_fov;
+    vector<uint8_t> looking_at;
+
+    // static targets, in their own reference frame
+    AttentionTargets static_targets;
+    AttentionTargetsIndex static_targets_index;
+    string static_targets_frame;
+    Observers faces_in_static_frame;
+    vector<size_t> static_targets_in_fov;
+
+    // mesh of the environment
+    SceneMesh scene;
+    string scene_frame;
+    Observers faces_in_scene_frame;
+
+    // attention heat map
+    bool heatmap_enabled = false;
+    AttentionHeatmap heatmap;
+    string heatmap_prefix;
+    ros::Timer heatmap_timer;
+    double frame_duration = 0; // time attributed to the frame being processed
 
-    // Prepare a range sensor msg to represent the fields of view
     sensor_msgs::Range fov;
+    ros::Time last_face_seen;
+};
+
+FocusOfAttentionEstimator::FocusOfAttentionEstimator(ros::NodeHandle& rosNode,
+                                                     const vector<string>& monitored_frames):
+    monitored_frames(monitored_frames)
+{
+    marker_pub = rosNode.advertise<visualization_msgs::Marker>("estimate_focus", 1);
+    fov_pub = rosNode.advertise<sensor_msgs::Range>("field_of_view", 10);
+    frames_in_fov_pub = rosNode.advertise<std_msgs::String>("actual_focus_of_attention", 1);
+    mutual_gaze_pub = rosNode.advertise<std_msgs::String>("mutual_gaze", 1);
+    gaze_hits_pub = rosNode.advertise<std_msgs::String>("gaze_hits", 1);
 
+    // Prepare a range sensor msg to represent the fields of view
     fov.radiation_type = sensor_msgs::Range::INFRARED;
     fov.field_of_view = FOV;
     fov.min_range = 0;
     fov.max_range = 10;
     fov.range = RANGE;
 
+    tf_sub = rosNode.subscribe("/tf", 100, &FocusOfAttentionEstimator::onTf, this);
+    watchdog = rosNode.createTimer(ros::Duration(FACE_TIMEOUT), &FocusOfAttentionEstimator::onWatchdog, this);
+}
+
+void FocusOfAttentionEstimator::setStaticTargets(const AttentionTargets& targets, const string& frame)
+{
+    static_targets = targets;
+    static_targets_index.build(static_targets);
+    static_targets_frame = frame;
+}
+
+bool FocusOfAttentionEstimator::loadScene(const string& filename, const string& frame)
+{
+    if (!scene.load(filename)) return false;
+
+    // built once for all: the scene is static
+    scene.build();
+    scene_frame = frame;
+
+    return true;
+}
+
+void FocusOfAttentionEstimator::enableHeatmap(ros::NodeHandle& rosNode, const string& prefix, double period, float voxel_size)
+{
+    heatmap_enabled = true;
+    heatmap_prefix = prefix;
+    heatmap.voxel_size = voxel_size;
+    heatmap_timer = rosNode.createTimer(ros::Duration(period), &FocusOfAttentionEstimator::onHeatmapExport, this);
+}
+
+void FocusOfAttentionEstimator::onHeatmapExport(const ros::TimerEvent& event)
+{
+    if (!heatmap.exportDwellTimes(heatmap_prefix + "_dwell.csv") ||
+        !heatmap.exportVoxels(heatmap_prefix + "_voxels.csv")) {
+        ROS_WARN_STREAM("Could not export the attention heat map to " << heatmap_prefix << "_*.csv");
+    }
+}
+
+bool FocusOfAttentionEstimator::transformFaces(const string& camera_frame, const string& frame, Observers& transformed_faces)
+{
+    transformed_faces.clear();
+
+    tf::StampedTransform transform;
+    try {
+        listener.lookupTransform(frame, camera_frame, ros::Time(0), transform);
+    }
+    catch (tf::TransformException& ex) {
+        ROS_WARN_STREAM_THROTTLE(5, ex.what());
+        return false;
+    }
+
+    for (size_t i = 0; i < faces.size(); ++i) {
+        auto position = transform * tf::Vector3(faces.x[i], faces.y[i], faces.z[i]);
+        auto axis = transform.getBasis() * tf::Vector3(faces.dx[i], faces.dy[i], faces.dz[i]);
+        transformed_faces.add(position.x(), position.y(), position.z(),
+                              axis.x(), axis.y(), axis.z());
+    }
+
+    return true;
+}
+
+void FocusOfAttentionEstimator::onTf(const tf2_msgs::TFMessageConstPtr& msg)
+{
+    string camera_frame;
+    ros::Time stamp;
 
-  ROS_INFO("Waiting until a face becomes visible...");
-  while (!listener.waitForTransform("base_footprint", "face_0", ros::Time::now(), ros::Duration(5.0))) {
-        ROS_DEBUG("Still no face visible...");
-        r.sleep();
-  }
+    face_frames.clear();
+    faces.clear();
 
-  ROS_INFO("Face detected! We can start estimating the focus of attention...");
+    for (const auto& transform : msg->transforms) {
+        auto frame = tf::strip_leading_slash(transform.child_frame_id);
+        if (frame.find(HUMAN_FRAME_PREFIX) != 0) continue;
 
-  while (ros::ok())
-  {
-    
-    // Publish the marker
-    while (marker_pub.getNumSubscribers() < 1 && fov_pub.getNumSubscribers() < 1)
-    {
-      if (!ros::ok())
-      {
-        return 0;
-      }
-      ROS_WARN_ONCE("Please create a subscriber to the marker or field of view");
-      sleep(1);
+        if (camera_frame.empty()) {
+            camera_frame = transform.header.frame_id;
+            stamp = transform.header.stamp;
+        }
+        else if (transform.header.frame_id != camera_frame) {
+            ROS_WARN_STREAM_THROTTLE(5, "Face " << frame << " is not published in the same frame as the other faces. Ignoring it.");
+            continue;
+        }
+
+        tf::Quaternion qrot;
+        tf::quaternionMsgToTF(transform.transform.rotation, qrot);
+        // the field of view's main axis is the face's X axis
+        auto axis = tf::Matrix3x3(qrot).getColumn(0);
+
+        face_frames.push_back(frame);
+        faces.add(transform.transform.translation.x,
+                  transform.transform.translation.y,
+                  transform.transform.translation.z,
+                  axis.x(), axis.y(), axis.z());
     }
 
-    frames.clear();
-    listener.getFrameStrings(frames);
+    if (faces.size() == 0) return;
 
-    int nb_faces = 0;
+    ROS_INFO_ONCE("Face detected! We can start estimating the focus of attention...");
+
+    last_face_seen = ros::Time::now();
+
+    for (const auto& frame : visible_faces) {
+        if (find(face_frames.begin(), face_frames.end(), frame) == face_frames.end()) {
+            hideFieldOfView(frame);
+        }
+    }
+    visible_faces = face_frames;
+
+    if ((last_face_seen - stamp).toSec() > MAX_LATENCY) {
+        ROS_WARN_THROTTLE(5, "Head poses are getting too old: skipping some to keep up.");
+        return;
+    }
+
+    if (!heatmap_enabled &&
+        marker_pub.getNumSubscribers() == 0 &&
+        fov_pub.getNumSubscribers() == 0 &&
+        frames_in_fov_pub.getNumSubscribers() == 0 &&
+        mutual_gaze_pub.getNumSubscribers() == 0 &&
+        gaze_hits_pub.getNumSubscribers() == 0) {
+        ROS_WARN_ONCE("Please create a subscriber to the marker, focus of attention, mutual gaze, gaze hits or field of view");
+        return;
+    }
+
+    if (heatmap_enabled) frame_duration = heatmap.frameDuration(stamp.toSec());
+
+    // one lookup per monitored frame, shared by all the faces. We use the
+    // latest available transform: waiting for the exact timestamp of the
+    // faces would add latency.
+    targets.clear();
+    target_ids.clear();
+    for (size_t i = 0; i < monitored_frames.size(); ++i) {
+        tf::StampedTransform transform;
+        try {
+            listener.lookupTransform(camera_frame, monitored_frames[i], ros::Time(0), transform);
+        }
+        catch (tf::TransformException& ex) {
+            ROS_WARN_STREAM_THROTTLE(5, ex.what());
+            continue;
+        }
+        targets.add(monitored_frames[i],
+                    transform.getOrigin().x(),
+                    transform.getOrigin().y(),
+                    transform.getOrigin().z());
+        target_ids.push_back(i);
+    }
+
+    computeFieldOfView(faces, targets, FOV, in_fov);
+
+    // express the faces in the frame of the static targets (one lookup for all the faces)
+    faces_in_static_frame.clear();
+    if (static_targets_index.size() > 0) {
+        transformFaces(camera_frame, static_targets_frame, faces_in_static_frame);
+    }
+    vector<bool> static_attended(static_targets.size(), false);
 
     std_msgs::String frames_in_fov;
+    stringstream ss;
+    vector<bool> attended(targets.size(), false);
+
+    for (size_t i = 0; i < faces.size(); ++i) {
+        if (i > 0) ss << "\n";
+        ss << face_frames[i];
+        for (size_t j = 0; j < targets.size(); ++j) {
+            if (in_fov[i * targets.size() + j]) {
+                ROS_DEBUG_STREAM(targets.names[j] << " is in the field of view of " << face_frames[i]);
+                ss << " " << targets.names[j];
+                attended[j] = true;
+                if (heatmap_enabled) heatmap.addDwell(face_frames[i], targets.names[j], frame_duration);
+            }
+        }
 
-    for(auto frame : frames) {
-        if(frame.find(HUMAN_FRAME_PREFIX) == 0) {
-
-            nb_faces++;
-
-            int face_idx = stoi(frame.substr(HUMAN_FRAME_PREFIX.length(), 1));
-
-            if (face_idx == 0) {
-                
-                stringstream ss;
-                for(size_t i = 0 ; i < monitored_frames.size(); ++i) {
-                    if(isInFieldOfView(listener, monitored_frames[i], frame)) {
-                        ROS_DEBUG_STREAM(monitored_frames[i] << " is in the field of view of " << frame);
-                        marker_pub.publish(makeMarker(i, monitored_frames[i], colors[i]));
-                        if (!ss.str().empty()) ss << " ";
-                        ss << monitored_frames[i];
-                    }
-                }
-                frames_in_fov.data = ss.str();
-                frames_in_fov_pub.publish(frames_in_fov);
-
-                fov.range = RANGE;
-                fov.header.stamp = ros::Time::now();
-                fov.header.frame_id = frame;
-                fov_pub.publish(fov); 
+        if (faces_in_static_frame.size() > 0) {
+            static_targets_in_fov.clear();
+            static_targets_index.query(faces_in_static_frame, i, FOV, static_targets_in_fov);
+            for (auto j : static_targets_in_fov) {
+                ss << " " << static_targets.names[j];
+                static_attended[j] = true;
+                if (heatmap_enabled) heatmap.addDwell(face_frames[i], static_targets.names[j], frame_duration);
             }
         }
+
+        fov.range = RANGE;
+        fov.header.stamp = stamp;
+        fov.header.frame_id = face_frames[i];
+        fov_pub.publish(fov);
+    }
+
+    for (size_t j = 0; j < targets.size(); ++j) {
+        if (attended[j]) {
+            marker_pub.publish(makeMarker(target_ids[j], targets.names[j], colors[target_ids[j] % colors.size()]));
+        }
     }
-    if (nb_faces == 0) {
 
-        // hide the field of view
-        fov.range = 0;
+    for (size_t j = 0; j < static_targets.size(); ++j) {
+        if (static_attended[j]) {
+            auto id = monitored_frames.size() + j;
+            marker_pub.publish(makeMarker(id, static_targets_frame, colors[id % colors.size()],
+                                          static_targets.x[j], static_targets.y[j], static_targets.z[j],
+                                          max(0.04f, 2 * static_targets.radius[j])));
+        }
+    }
+
+    frames_in_fov.data = ss.str();
+    frames_in_fov_pub.publish(frames_in_fov);
+
+    publishMutualGaze(camera_frame, stamp);
+
+    if (scene.nbTriangles() > 0) publishGazeHits(camera_frame, stamp);
+}
+
+/**
+ * Publishes what each face is looking at in the environment mesh, as one
+ * 'face object x y z' line per face (the point being in the scene frame).
+ */
+void FocusOfAttentionEstimator::publishGazeHits(const string& camera_frame, const ros::Time& stamp)
+{
+    if (!transformFaces(camera_frame, scene_frame, faces_in_scene_frame)) return;
+
+    std_msgs::String gaze_hits;
+    stringstream ss;
 
-        fov.header.stamp = ros::Time::now();
-        fov.header.frame_id = "face_0";
-        fov_pub.publish(fov); 
+    for (size_t i = 0; i < faces_in_scene_frame.size(); ++i) {
+        RayHit hit;
+        if (!scene.raycast(faces_in_scene_frame, i, hit)) continue;
 
+        if (!ss.str().empty()) ss << "\n";
+        ss << face_frames[i] << " " << scene.objects()[hit.object] << " " << hit.x << " " << hit.y << " " << hit.z;
+
+        if (heatmap_enabled) {
+            heatmap.addDwell(face_frames[i], scene.objects()[hit.object], frame_duration);
+            heatmap.addGazePoint(hit.x, hit.y, hit.z, frame_duration);
+        }
+
+        auto marker = makeMarker(i, scene_frame, RED, hit.x, hit.y, hit.z);
+        marker.ns = "gaze_hits";
+        marker_pub.publish(marker);
     }
-    r.sleep();
-  }
+
+    gaze_hits.data = ss.str();
+    gaze_hits_pub.publish(gaze_hits);
+}
+
+/**
+ * Publishes who is looking at whom, as one 'observer target' line per edge
+ * of the looking-at graph, and as a list of lines for visualization.
+ */
+void FocusOfAttentionEstimator::publishMutualGaze(const string& camera_frame, const ros::Time& stamp)
+{
+    computeMutualGaze(faces, FOV, HEAD_RADIUS, looking_at);
+
+    std_msgs::String mutual_gaze;
+    stringstream ss;
+
+    visualization_msgs::Marker edges;
+    edges.header.frame_id = camera_frame;
+    edges.header.stamp = stamp;
+    edges.ns = "mutual_gaze";
+    edges.id = 0;
+    edges.type = visualization_msgs::Marker::LINE_LIST;
+    edges.action = visualization_msgs::Marker::ADD;
+    edges.pose.orientation.w = 1.0;
+    edges.scale.x = 0.01;
+    edges.color = GREEN;
+    edges.lifetime = ros::Duration(0.5);
+
+    for (size_t i = 0; i < faces.size(); ++i) {
+        for (size_t j = 0; j < faces.size(); ++j) {
+            if (!looking_at[i * faces.size() + j]) continue;
+
+            if (!ss.str().empty()) ss << "\n";
+            ss << face_frames[i] << " " << face_frames[j];
+
+            geometry_msgs::Point from, to;
+            from.x = faces.x[i]; from.y = faces.y[i]; from.z = faces.z[i];
+            to.x = faces.x[j]; to.y = faces.y[j]; to.z = faces.z[j];
+            edges.points.push_back(from);
+            edges.points.push_back(to);
+        }
+    }
+
+    mutual_gaze.data = ss.str();
+    mutual_gaze_pub.publish(mutual_gaze);
+
+    if (!edges.points.empty()) marker_pub.publish(edges);
+}
+
+void FocusOfAttentionEstimator::onWatchdog(const ros::TimerEvent& event)
+{
+    if (!visible_faces.empty() && (ros::Time::now() - last_face_seen).toSec() > FACE_TIMEOUT) {
+        for (const auto& frame : visible_faces) {
+            hideFieldOfView(frame);
+        }
+        visible_faces.clear();
+    }
+}
+
+void FocusOfAttentionEstimator::hideFieldOfView(const string& face_frame)
+{
+    fov.range = 0;
+    fov.header.stamp = ros::Time::now();
+    fov.header.frame_id = face_frame;
+    fov_pub.publish(fov);
+}
+
+int main( int argc, char** argv )
+{
+    GREEN.r = 0.; GREEN.g = 1.; GREEN.b = 0.; GREEN.a = 1.;
+    BLUE.r = 0.; BLUE.g = 0.; BLUE.b = 1.; BLUE.a = 1.;
+    RED.r = 1.; RED.g = 0.; RED.b = 0.; RED.a = 1.;
+    colors.push_back(GREEN);
+    colors.push_back(BLUE);
+    colors.push_back(RED);
+
+    ros::init(argc, argv, "estimate_focus");
+    ros::NodeHandle n;
+    ros::NodeHandle _private_node("~");
+
+    // frames whose position is looked up on TF each time the faces move
+    vector<string> monitored_frames;
+    _private_node.param<vector<string>>("monitored_frames", monitored_frames,
+                                        {"/robot_head", "/tablet", "/selection_tablet", "/experimenter"});
+
+    // static targets, loaded from a file (see loadAttentionTargets for the format)
+    string targets_file;
+    _private_node.param<string>("targets", targets_file, "");
+
+    // mesh of the environment, as a Wavefront OBJ file
+    string scene_file;
+    _private_node.param<string>("scene_mesh", scene_file, "");
+    string scene_frame;
+    _private_node.param<string>("scene_frame", scene_frame, "map");
+
+    // attention heat map: exported every heatmap_period seconds to
+    // <heatmap_prefix>_dwell.csv and <heatmap_prefix>_voxels.csv
+    string heatmap_prefix;
+    _private_node.param<string>("heatmap_prefix", heatmap_prefix, "");
+    double heatmap_period;
+    _private_node.param<double>("heatmap_period", heatmap_period, 60.);
+    double heatmap_voxel_size;
+    _private_node.param<double>("heatmap_voxel_size", heatmap_voxel_size, 0.1);
+
+    FocusOfAttentionEstimator estimator(n, monitored_frames);
+
+    if (!heatmap_prefix.empty()) {
+        estimator.enableHeatmap(n, heatmap_prefix, heatmap_period, heatmap_voxel_size);
+        ROS_INFO_STREAM("Attention heat map exported every " << heatmap_period << "s to " << heatmap_prefix << "_*.csv");
+    }
+
+    if (!targets_file.empty()) {
+        AttentionTargets static_targets;
+        string static_targets_frame = "map";
+        if (!loadAttentionTargets(targets_file, static_targets, static_targets_frame)) {
+            ROS_ERROR_STREAM("Could not load the attention targets from " << targets_file);
+            return 1;
+        }
+        estimator.setStaticTargets(static_targets, static_targets_frame);
+        ROS_INFO_STREAM("Monitoring " << static_targets.size() << " static targets in frame " << static_targets_frame);
+    }
+
+    if (!scene_file.empty()) {
+        if (!estimator.loadScene(scene_file, scene_frame)) {
+            ROS_ERROR_STREAM("Could not load the scene mesh " << scene_file);
+            return 1;
+        }
+        ROS_INFO_STREAM("Head directions will be intersected with the scene mesh " << scene_file);
+    }
+
+    ROS_INFO("Waiting until a face becomes visible...");
+    ros::spin();
+
+    return 0;
 }
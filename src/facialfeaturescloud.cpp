@@ -194,6 +194,10 @@ void FacialFeaturesPointCloudPublisher::imageCb(const sensor_msgs::ImageConstPtr
 
         nb_detected_faces_pub.publish(nb_faces);
 
+        // all the faces are broadcast in a single TF message, so that consumers
+        // (like estimate_focus) process them together
+        std::vector<tf::StampedTransform> transforms;
+
         for(size_t face_idx = 0; face_idx < poses.size(); ++face_idx) {
 
             auto trans = poses[face_idx];
@@ -216,9 +220,10 @@ void FacialFeaturesPointCloudPublisher::imageCb(const sensor_msgs::ImageConstPtr
                     rgb_msg->header.stamp,  // publish the transform with the same timestamp as the frame originally used
                     cameramodel.tfFrame(),
                     facePrefix + "_" + to_string(face_idx));
-            br.sendTransform(transform);
+            transforms.push_back(transform);
 
         }
+        br.sendTransform(transforms);
 
 #ifdef HEAD_POSE_ESTIMATION_DEBUG
         if(pub.getNumSubscribers() > 0) {
@@ -0,0 +1,562 @@
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <new>
+#include <list>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <algorithm>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <semaphore.h>
+
+#include "frame_service.hpp"
+#include "thread_pool.hpp"
+
+using namespace std;
+
+static const char SERVICE_MAGIC[8] = {'G', 'A', 'Z', 'R', 'S', 'E', 'R', 'V'};
+static const uint32_t SERVICE_VERSION = 1;
+static const size_t NB_LANDMARKS = 68;
+static const size_t ALIGNMENT = 64; // cache line
+
+/* Layout of the shared memory segments.
+ *
+ * The registry is created by the service. A client claims a free entry,
+ * writes the name of its channel in it, marks it CONNECTED, and posts
+ * `connect`. The service maps the channel and marks the entry ATTACHED; it
+ * frees the entry once the client disconnected (or died).
+ *
+ * A channel is created by its client: a header, followed by `nb_slots` slots
+ * (a header with the results, and the pixels). The client posts `submitted`
+ * for every frame; the service posts the `done` semaphore of the slot once
+ * its results are written.
+ */
+
+enum ClientState : uint32_t {FREE = 0, CLAIMED, CONNECTED, ATTACHED};
+
+struct ServiceRegistry {
+    char magic[8];
+    uint32_t version;
+    int32_t service_pid;
+    sem_t connect; // posted by the clients when they connect
+    struct Entry {
+        std::atomic<uint32_t> state;
+        int32_t pid;
+        char channel[64];
+    } clients[FRAME_SERVICE_MAX_CLIENTS];
+};
+
+struct FaceRecord {
+    int32_t box[4];
+    int16_t landmarks[2 * NB_LANDMARKS];
+    double pose[16];
+};
+
+struct SlotHeader {
+    sem_t done;
+    uint64_t frame_id;
+    double timestamp;
+    int32_t width, height;
+    uint32_t nb_faces;
+    uint32_t truncated;
+    FaceRecord faces[FRAME_SERVICE_MAX_FACES];
+};
+
+struct ServiceChannel {
+    char magic[8];
+    uint32_t version;
+    uint32_t nb_slots;
+    uint64_t slot_size; // size of the pixels of a slot, in bytes
+    int32_t client_pid;
+    sem_t submitted;
+    std::atomic<uint64_t> nb_submitted;
+    std::atomic<uint32_t> closed;
+};
+
+static size_t aligned(size_t size)
+{
+    return (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+static size_t slotStride(size_t slot_size)
+{
+    return aligned(sizeof(SlotHeader)) + aligned(slot_size);
+}
+
+static size_t channelSize(size_t nb_slots, size_t slot_size)
+{
+    return aligned(sizeof(ServiceChannel)) + nb_slots * slotStride(slot_size);
+}
+
+/** Slot of the `idx`-th frame submitted on a channel.
+ */
+static SlotHeader* slotOf(ServiceChannel* channel, uint64_t idx)
+{
+    char* slots = reinterpret_cast<char*>(channel) + aligned(sizeof(ServiceChannel));
+    return reinterpret_cast<SlotHeader*>(slots + (idx % channel->nb_slots) * slotStride(channel->slot_size));
+}
+
+static uchar* pixelsOf(SlotHeader* slot)
+{
+    return reinterpret_cast<uchar*>(slot) + aligned(sizeof(SlotHeader));
+}
+
+/** Maps a shared memory segment. If `create` is true, the segment is
+ * created with the given size, otherwise `size` is set to its size.
+ */
+static void* mapSegment(const string& name, size_t& size, bool create)
+{
+    int fd = shm_open(name.c_str(), create ? O_RDWR | O_CREAT | O_EXCL : O_RDWR, 0600);
+    if (fd < 0) return nullptr;
+
+    struct stat st;
+    if ((create && ftruncate(fd, size) != 0) || (!create && fstat(fd, &st) != 0)) {
+        close(fd);
+        if (create) shm_unlink(name.c_str());
+        return nullptr;
+    }
+    if (!create) size = st.st_size;
+
+    void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd); // the mapping stays valid
+
+    if (data == MAP_FAILED) {
+        if (create) shm_unlink(name.c_str());
+        return nullptr;
+    }
+    return data;
+}
+
+/** Waits for a semaphore, at most `timeout` seconds (forever if negative).
+ */
+static bool waitFor(sem_t* semaphore, double timeout)
+{
+    if (timeout < 0) {
+        while (sem_wait(semaphore) != 0) {
+            if (errno != EINTR) return false;
+        }
+        return true;
+    }
+
+    timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    const long long nsec = deadline.tv_nsec + static_cast<long long>(timeout * 1e9);
+    deadline.tv_sec += nsec / 1000000000;
+    deadline.tv_nsec = nsec % 1000000000;
+
+    while (sem_timedwait(semaphore, &deadline) != 0) {
+        if (errno != EINTR) return false;
+    }
+    return true;
+}
+
+static bool isAlive(pid_t pid)
+{
+    return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Client
+
+FrameClient::FrameClient(const string& service, size_t nb_slots, size_t max_frame_size, double timeout) :
+    registry(nullptr),
+    registry_slot(-1),
+    channel(nullptr),
+    channel_size(0),
+    head(0),
+    tail(0),
+    acquired(false)
+{
+    size_t registry_size;
+    registry = static_cast<ServiceRegistry*>(mapSegment(service, registry_size, false));
+    if (!registry) return; // the service is not running
+
+    if (registry_size < sizeof(ServiceRegistry) ||
+        memcmp(registry->magic, SERVICE_MAGIC, sizeof(SERVICE_MAGIC)) != 0 ||
+        registry->version != SERVICE_VERSION) {
+        disconnect();
+        return;
+    }
+
+    static std::atomic<unsigned> nb_channels(0); // in this process
+    channel_name = service + "-" + to_string(getpid()) + "-" + to_string(nb_channels++);
+    if (channel_name.size() >= sizeof(ServiceRegistry::Entry::channel)) {
+        disconnect();
+        return;
+    }
+
+    nb_slots = max<size_t>(nb_slots, 1);
+    channel_size = channelSize(nb_slots, max_frame_size);
+
+    shm_unlink(channel_name.c_str()); // left by a crashed process with the same PID
+    auto channel_memory = mapSegment(channel_name, channel_size, true);
+    if (!channel_memory) {
+        disconnect();
+        return;
+    }
+
+    auto new_channel = new (channel_memory) ServiceChannel;
+    memcpy(new_channel->magic, SERVICE_MAGIC, sizeof(SERVICE_MAGIC));
+    new_channel->version = SERVICE_VERSION;
+    new_channel->nb_slots = nb_slots;
+    new_channel->slot_size = max_frame_size;
+    new_channel->client_pid = getpid();
+    sem_init(&new_channel->submitted, 1, 0);
+    new_channel->nb_submitted = 0;
+    new_channel->closed = 0;
+    for (size_t i = 0; i < nb_slots; ++i) {
+        sem_init(&slotOf(new_channel, i)->done, 1, 0);
+    }
+
+    // registration
+    for (size_t i = 0; i < FRAME_SERVICE_MAX_CLIENTS; ++i) {
+        uint32_t expected = FREE;
+        if (registry->clients[i].state.compare_exchange_strong(expected, CLAIMED)) {
+            registry_slot = i;
+            break;
+        }
+    }
+    if (registry_slot < 0) { // too many clients
+        munmap(new_channel, channel_size);
+        disconnect();
+        return;
+    }
+
+    auto& entry = registry->clients[registry_slot];
+    entry.pid = getpid();
+    strncpy(entry.channel, channel_name.c_str(), sizeof(entry.channel));
+    entry.state = CONNECTED;
+    sem_post(&registry->connect);
+
+    const auto deadline = chrono::steady_clock::now() + chrono::duration<double>(timeout);
+    while (entry.state != ATTACHED && chrono::steady_clock::now() < deadline) {
+        this_thread::sleep_for(chrono::milliseconds(5));
+    }
+
+    uint32_t expected = CONNECTED;
+    if (entry.state != ATTACHED && entry.state.compare_exchange_strong(expected, FREE)) { // the service did not answer
+        registry_slot = -1;
+        munmap(new_channel, channel_size);
+        disconnect();
+        return;
+    }
+
+    // the service has mapped the channel: it is freed as soon as both sides unmap it
+    shm_unlink(channel_name.c_str());
+    channel = new_channel;
+}
+
+FrameClient::~FrameClient()
+{
+    disconnect();
+}
+
+void FrameClient::disconnect()
+{
+    if (channel) {
+        // wakes the service up: it frees the registry entry
+        channel->closed = 1;
+        sem_post(&channel->submitted);
+        munmap(channel, channel_size);
+        channel = nullptr;
+    }
+    else if (!channel_name.empty()) {
+        shm_unlink(channel_name.c_str());
+    }
+
+    if (registry) {
+        munmap(registry, sizeof(ServiceRegistry));
+        registry = nullptr;
+    }
+}
+
+cv::Mat FrameClient::acquireFrame(int width, int height)
+{
+    if (!channel || head - tail >= channel->nb_slots) return cv::Mat();
+    if (width <= 0 || height <= 0 || static_cast<uint64_t>(width) * height * 3 > channel->slot_size) return cv::Mat();
+
+    auto slot = slotOf(channel, head);
+    slot->width = width;
+    slot->height = height;
+    acquired = true;
+
+    return cv::Mat(height, width, CV_8UC3, pixelsOf(slot));
+}
+
+bool FrameClient::submit(uint64_t frame_id, double timestamp)
+{
+    if (!channel || !acquired) return false;
+
+    auto slot = slotOf(channel, head);
+    slot->frame_id = frame_id;
+    slot->timestamp = timestamp;
+
+    acquired = false;
+    head++;
+    channel->nb_submitted++;
+    sem_post(&channel->submitted);
+    return true;
+}
+
+bool FrameClient::receive(ServiceResult& result, double timeout)
+{
+    if (!channel || tail == head) return false;
+
+    auto slot = slotOf(channel, tail);
+    if (!waitFor(&slot->done, timeout)) return false;
+
+    result.frame_id = slot->frame_id;
+    result.timestamp = slot->timestamp;
+    result.truncated = slot->truncated;
+    result.faces.clear();
+    result.features.clear();
+    result.poses.clear();
+
+    for (size_t i = 0; i < slot->nb_faces; ++i) {
+        const auto& face = slot->faces[i];
+
+        result.faces.push_back(cv::Rect(face.box[0], face.box[1], face.box[2], face.box[3]));
+
+        vector<cv::Point> features;
+        for (size_t j = 0; j < NB_LANDMARKS; ++j) {
+            features.push_back(cv::Point(face.landmarks[2 * j], face.landmarks[2 * j + 1]));
+        }
+        result.features.push_back(features);
+
+        head_pose pose;
+        for (size_t j = 0; j < 16; ++j) pose.val[j] = face.pose[j];
+        result.poses.push_back(pose);
+    }
+
+    tail++;
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Service
+
+FrameService::FrameService(const HeadPoseEstimation& prototype, size_t nb_threads, const string& name) :
+    prototype(prototype),
+    nb_threads(max<size_t>(nb_threads, 1)),
+    name(name),
+    registry(nullptr),
+    nb_clients(0),
+    nb_frames(0)
+{
+    shm_unlink(name.c_str()); // left by a previous instance
+
+    size_t size = sizeof(ServiceRegistry);
+    auto memory = mapSegment(name, size, true);
+    if (!memory) return;
+
+    auto new_registry = new (memory) ServiceRegistry;
+    memcpy(new_registry->magic, SERVICE_MAGIC, sizeof(SERVICE_MAGIC));
+    new_registry->version = SERVICE_VERSION;
+    new_registry->service_pid = getpid();
+    sem_init(&new_registry->connect, 1, 0);
+    for (auto& entry : new_registry->clients) {
+        entry.state = FREE;
+        entry.pid = 0;
+    }
+
+    registry = new_registry;
+}
+
+FrameService::~FrameService()
+{
+    if (!registry) return;
+    munmap(registry, sizeof(ServiceRegistry));
+    shm_unlink(name.c_str());
+}
+
+void FrameService::run(const atomic<bool>& stop)
+{
+    if (!registry) return;
+
+    // one estimator per worker thread (they share the landmarks model)
+    vector<HeadPoseEstimation> estimators(nb_threads, prototype);
+    // consecutive frames of an estimator come from different clients: no
+    // extrapolation from the previous frame
+    for (auto& estimator : estimators) estimator.timeBudget = 0;
+    vector<HeadPoseEstimation*> available_estimators;
+    for (auto& estimator : estimators) available_estimators.push_back(&estimator);
+    mutex estimators_mutex;
+
+    // processes the frame of a slot, in place
+    auto process = [&](SlotHeader* slot, size_t slot_size) {
+        slot->nb_faces = 0;
+        slot->truncated = 0;
+        if (slot->width <= 0 || slot->height <= 0 ||
+            static_cast<uint64_t>(slot->width) * slot->height * 3 > slot_size) return;
+
+        cv::Mat frame(slot->height, slot->width, CV_8UC3, pixelsOf(slot));
+
+        // there are as many estimators as worker threads: one is always available
+        HeadPoseEstimation* estimator;
+        {
+            lock_guard<mutex> lock(estimators_mutex);
+            estimator = available_estimators.back();
+            available_estimators.pop_back();
+        }
+
+        // returns the estimator to the pool, even if the processing throws
+        struct EstimatorLease {
+            vector<HeadPoseEstimation*>& pool;
+            mutex& pool_mutex;
+            HeadPoseEstimation* estimator;
+            ~EstimatorLease() {
+                lock_guard<mutex> lock(pool_mutex);
+                pool.push_back(estimator);
+            }
+        } lease = {available_estimators, estimators_mutex, estimator};
+
+        // the clients might send frames of different sizes
+        estimator->opticalCenterX = frame.cols / 2;
+        estimator->opticalCenterY = frame.rows / 2;
+
+        auto features = estimator->update(frame);
+        auto poses = estimator->poses();
+        auto boxes = estimator->detections();
+
+        slot->truncated = poses.size() > FRAME_SERVICE_MAX_FACES;
+        slot->nb_faces = min(poses.size(), FRAME_SERVICE_MAX_FACES);
+        for (size_t i = 0; i < slot->nb_faces; ++i) {
+            auto& face = slot->faces[i];
+
+            face.box[0] = boxes[i].x;
+            face.box[1] = boxes[i].y;
+            face.box[2] = boxes[i].width;
+            face.box[3] = boxes[i].height;
+
+            for (size_t j = 0; j < NB_LANDMARKS; ++j) {
+                const bool known = j < features[i].size();
+                face.landmarks[2 * j] = known ? features[i][j].x : 0;
+                face.landmarks[2 * j + 1] = known ? features[i][j].y : 0;
+            }
+
+            for (size_t j = 0; j < 16; ++j) face.pose[j] = poses[i].val[j];
+        }
+    };
+
+    ThreadPool workers(nb_threads);
+
+    struct Client {
+        size_t registry_slot;
+        ServiceChannel* channel;
+        size_t channel_size;
+        thread server;
+        atomic<bool> done;
+    };
+
+    // serves one client, until it disconnects or dies
+    auto serve = [&](Client& client) {
+        auto channel = client.channel;
+        deque<future<void>> in_flight;
+        uint64_t nb_received = 0;
+
+        while (!stop) {
+            if (!waitFor(&channel->submitted, 0.2)) {
+                if (!isAlive(channel->client_pid)) break;
+                continue;
+            }
+
+            if (nb_received == channel->nb_submitted) { // woken up by the disconnection
+                if (channel->closed) break;
+                continue;
+            }
+
+            auto slot = slotOf(channel, nb_received++);
+            const size_t slot_size = channel->slot_size;
+            in_flight.push_back(workers.submit([this, &process, slot, slot_size]() {
+                try {
+                    process(slot, slot_size);
+                }
+                catch (...) {
+                    // no results, but the client must not wait forever
+                    slot->nb_faces = 0;
+                    slot->truncated = 0;
+                }
+                nb_frames++;
+                sem_post(&slot->done);
+            }));
+
+            while (!in_flight.empty() && in_flight.front().wait_for(chrono::seconds(0)) == future_status::ready) {
+                in_flight.pop_front();
+            }
+        }
+
+        for (auto& frame : in_flight) frame.wait();
+        client.done = true;
+        sem_post(&registry->connect); // wakes the main loop up, to clean up
+    };
+
+    list<unique_ptr<Client>> clients;
+
+    auto detach = [this](Client& client) {
+        client.server.join();
+        munmap(client.channel, client.channel_size);
+        registry->clients[client.registry_slot].state = FREE;
+        nb_clients--;
+    };
+
+    while (!stop) {
+        waitFor(&registry->connect, 0.2);
+
+        for (size_t i = 0; i < FRAME_SERVICE_MAX_CLIENTS; ++i) {
+            auto& entry = registry->clients[i];
+            if (entry.state != CONNECTED) continue;
+
+            char channel_name[sizeof(entry.channel)];
+            memcpy(channel_name, entry.channel, sizeof(channel_name));
+            channel_name[sizeof(channel_name) - 1] = 0;
+
+            size_t size;
+            auto channel = static_cast<ServiceChannel*>(mapSegment(channel_name, size, false));
+            if (!channel || size < sizeof(ServiceChannel) ||
+                memcmp(channel->magic, SERVICE_MAGIC, sizeof(SERVICE_MAGIC)) != 0 ||
+                channel->version != SERVICE_VERSION ||
+                size < channelSize(channel->nb_slots, channel->slot_size)) {
+                if (channel) munmap(channel, size);
+                uint32_t expected = CONNECTED; // unless the client gave up in the meantime
+                entry.state.compare_exchange_strong(expected, FREE);
+                continue;
+            }
+
+            // the client might have timed out (and released the entry) since
+            uint32_t expected = CONNECTED;
+            if (!entry.state.compare_exchange_strong(expected, ATTACHED)) {
+                munmap(channel, size);
+                continue;
+            }
+
+            unique_ptr<Client> client(new Client);
+            client->registry_slot = i;
+            client->channel = channel;
+            client->channel_size = size;
+            client->done = false;
+            client->server = thread(serve, std::ref(*client));
+            clients.push_back(std::move(client));
+
+            nb_clients++;
+        }
+
+        for (auto client = clients.begin(); client != clients.end();) {
+            if ((*client)->done) {
+                detach(**client);
+                client = clients.erase(client);
+            }
+            else ++client;
+        }
+    }
+
+    for (auto& client : clients) detach(*client);
+}
@@ -0,0 +1,148 @@
+#ifndef __FRAME_SERVICE
+#define __FRAME_SERVICE
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+
+#include "head_pose_estimation.hpp"
+
+/** Head pose estimation as a local service, for processes that would
+ * otherwise each load their own model (recorders, UI applications...).
+ *
+ * The service (FrameService, run by gazr_daemon) owns a single model, and a
+ * pool of estimators. Each client (FrameClient) creates a shared-memory ring
+ * of frame slots, and registers it with the service. The client writes its
+ * frames directly in the slots, the service processes them in place and
+ * writes the results back in the slot: the pixels are never copied.
+ *
+ * Synchronisation relies on process-shared POSIX semaphores (Linux only).
+ */
+
+const static char FRAME_SERVICE_DEFAULT_NAME[] = "/gazr";
+const static size_t FRAME_SERVICE_MAX_CLIENTS = 32;
+const static size_t FRAME_SERVICE_MAX_FACES = 16;
+
+/** Results of one frame, as returned by FrameClient::receive().
+ */
+struct ServiceResult {
+    uint64_t frame_id;
+    double timestamp;
+    bool truncated; // more than FRAME_SERVICE_MAX_FACES faces were detected
+    std::vector<cv::Rect> faces;
+    std::vector<std::vector<cv::Point>> features;
+    std::vector<head_pose> poses;
+};
+
+struct ServiceChannel;
+struct ServiceRegistry;
+
+/** Connection to a FrameService.
+ *
+ * Typical use:
+ *
+ *     FrameClient client;
+ *     if (!client.isConnected()) ...
+ *
+ *     cv::Mat frame = client.acquireFrame(640, 480);
+ *     video.read(frame); // decodes in the shared memory (same size and type: no reallocation)
+ *     client.submit(frame_id);
+ *
+ *     ServiceResult result;
+ *     client.receive(result);
+ *
+ * Up to `nb_slots` frames can be submitted before their results are
+ * received; results are received in submission order. A client is not
+ * thread-safe.
+ */
+class FrameClient {
+
+public:
+
+    /** Connects to the service. `max_frame_size` is the size (in bytes) of
+     * the largest frame to be submitted. Waits at most `timeout` seconds for
+     * the service to accept the connection.
+     */
+    FrameClient(const std::string& service = FRAME_SERVICE_DEFAULT_NAME,
+                size_t nb_slots = 4,
+                size_t max_frame_size = 1920 * 1080 * 3,
+                double timeout = 2.);
+
+    ~FrameClient();
+
+    FrameClient(const FrameClient&) = delete;
+    FrameClient& operator=(const FrameClient&) = delete;
+
+    bool isConnected() const {return channel != nullptr;}
+
+    /** Returns a (BGR) image of the given size, backed by the next free
+     * slot, to be filled with the next frame. Returns an empty image if all
+     * the slots are in use (receive() some results first), or if the frame
+     * is larger than `max_frame_size`.
+     */
+    cv::Mat acquireFrame(int width, int height);
+
+    /** Sends the frame of the last acquireFrame() to the service.
+     */
+    bool submit(uint64_t frame_id, double timestamp = 0);
+
+    /** Waits (at most `timeout` seconds, or forever if negative) for the
+     * results of the oldest submitted frame. Returns false on timeout, or if
+     * no frame is pending.
+     */
+    bool receive(ServiceResult& result, double timeout = -1);
+
+    size_t nbPending() const {return head - tail;}
+
+private:
+
+    void disconnect();
+
+    ServiceRegistry* registry;
+    int registry_slot;
+
+    std::string channel_name;
+    ServiceChannel* channel;
+    size_t channel_size;
+
+    uint64_t head; // number of submitted frames
+    uint64_t tail; // number of received results
+    bool acquired;
+};
+
+/** The service side: serves the clients registered under `name`, with
+ * `nb_threads` estimators (copies of `prototype`, sharing its model).
+ */
+class FrameService {
+
+public:
+
+    FrameService(const HeadPoseEstimation& prototype, size_t nb_threads, const std::string& name = FRAME_SERVICE_DEFAULT_NAME);
+
+    ~FrameService();
+
+    FrameService(const FrameService&) = delete;
+    FrameService& operator=(const FrameService&) = delete;
+
+    bool isOpen() const {return registry != nullptr;}
+
+    /** Serves the clients until `stop` becomes true.
+     */
+    void run(const std::atomic<bool>& stop);
+
+    size_t nbClients() const {return nb_clients;}
+    uint64_t nbFrames() const {return nb_frames;}
+
+private:
+
+    const HeadPoseEstimation prototype;
+    size_t nb_threads;
+    std::string name;
+    ServiceRegistry* registry;
+
+    std::atomic<size_t> nb_clients;
+    std::atomic<uint64_t> nb_frames;
+};
+
+#endif // __FRAME_SERVICE
@@ -3,6 +3,8 @@
 
 #include <cmath>
 #include <ctime>
+#include <numeric>
+#include <algorithm>
 #include <opencv2/calib3d/calib3d.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
@@ -21,21 +23,170 @@ inline Point toCv(const dlib::point& p)
     return Point(p.x(), p.y());
 }
 
+inline dlib::rectangle toDlib(const cv::Rect& r)
+{
+    return dlib::rectangle(r.x, r.y, r.x + r.width - 1, r.y + r.height - 1);
+}
+
+inline dlib::rectangle scaled(const dlib::rectangle& r, float factor)
+{
+    return dlib::rectangle(r.left() * factor, r.top() * factor,
+                           r.right() * factor, r.bottom() * factor);
+}
+
+inline full_object_detection scaled(const full_object_detection& shape, float factor)
+{
+    std::vector<dlib::point> parts;
+    for (unsigned long i = 0; i < shape.num_parts(); ++i) {
+        parts.push_back(dlib::point(shape.part(i).x() * factor, shape.part(i).y() * factor));
+    }
+    return full_object_detection(scaled(shape.get_rect(), factor), parts);
+}
+
 
 HeadPoseEstimation::HeadPoseEstimation(const string& face_detection_model, float focalLength) :
         focalLength(focalLength),
         opticalCenterX(-1),
-        opticalCenterY(-1)
+        opticalCenterY(-1),
+        timeBudget(0),
+        facePriority(LARGEST_FIRST),
+        detectionThreshold(0),
+        qualityPolicy(QUALITY_OFF),
+        nb_hinted_updates(0),
+        nb_deferred(0),
+        nb_rejected(0),
+        fit_cost(0),
+        pose_cost(0)
 {
     // Load face detection and pose estimation models.
     detector = get_frontal_face_detector();
-    deserialize(face_detection_model) >> pose_model;
+
+    auto model = std::make_shared<shape_predictor>();
+    deserialize(face_detection_model) >> *model;
+    pose_model = model;
 }
 
 
 std::vector<std::vector<Point>> HeadPoseEstimation::update(cv::InputArray _image)
 {
+    auto start = Clock::now();
+    Mat image = _image.getMat();
+    std::vector<double> scores;
+    auto rects = detectFaces(image, scores);
+    return fitFaces(image, rects, scores, start);
+}
+
+std::vector<std::vector<Point>> HeadPoseEstimation::update(cv::InputArray _image,
+                                                           const std::vector<cv::Rect>& hints,
+                                                           unsigned int full_frame_period)
+{
+    auto start = Clock::now();
+    Mat image = _image.getMat();
+
+    const bool full_frame = full_frame_period > 0 && nb_hinted_updates % full_frame_period == 0;
+    ++nb_hinted_updates;
+
+    std::vector<double> scores;
+    auto rects = full_frame ? detectFaces(image, scores)
+                            : detectFaces(image, searchRegions(hints, image.size()), scores);
+    return fitFaces(image, rects, scores, start);
+}
+
+std::vector<cv::Rect> HeadPoseEstimation::searchRegions(const std::vector<cv::Rect>& hints, cv::Size image_size)
+{
+    const cv::Rect bounds(0, 0, image_size.width, image_size.height);
+
+    std::vector<cv::Rect> regions;
+    for (const auto& hint : hints) {
+        // the head is at the top of a person box, within its width; some
+        // margin for the box inaccuracies and the tilted heads
+        const int margin = hint.width / 4;
+        const int height = std::min(hint.height, hint.width);
+        auto region = cv::Rect(hint.x - margin, hint.y - margin, hint.width + 2 * margin, height + 2 * margin) & bounds;
+        if (region.area() > 0) regions.push_back(region);
+    }
+
+    // merge the overlapping regions, so that no face is detected twice
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        for (size_t i = 0; i < regions.size() && !merged; ++i) {
+            for (size_t j = i + 1; j < regions.size(); ++j) {
+                if ((regions[i] & regions[j]).area() > 0) {
+                    regions[i] = regions[i] | regions[j];
+                    regions.erase(regions.begin() + j);
+                    merged = true;
+                    break;
+                }
+            }
+        }
+    }
+    return regions;
+}
 
+std::vector<cv::Rect> HeadPoseEstimation::detectFaces(cv::InputArray _image,
+                                                      const std::vector<cv::Rect>& regions,
+                                                      std::vector<double>& scores)
+{
+    Mat image = _image.getMat();
+
+    std::vector<cv::Rect> rects;
+    scores.clear();
+    for (const auto& region : regions) {
+        std::vector<double> region_scores;
+        for (const auto& rect : detectFaces(image(region), region_scores)) {
+            rects.push_back(rect + region.tl());
+        }
+        scores.insert(scores.end(), region_scores.begin(), region_scores.end());
+    }
+    return rects;
+}
+
+std::vector<cv::Rect> HeadPoseEstimation::detectFaces(cv::InputArray image)
+{
+    std::vector<double> scores;
+    return detectFaces(image, scores);
+}
+
+std::vector<cv::Rect> HeadPoseEstimation::detectFaces(cv::InputArray _image, std::vector<double>& scores)
+{
+    Mat image = _image.getMat();
+
+    // intermediate value to avoid potential compilation error:
+    //     conversion from ‘const cv::Mat’ to non-scalar type ‘IplImage’
+    auto ipl_img = cvIplImage(image);
+    cv_image<bgr_pixel> dlib_image(&ipl_img);
+
+    std::vector<rect_detection> detections;
+    detector(dlib_image, detections, detectionThreshold);
+
+    std::vector<cv::Rect> rects;
+    scores.clear();
+    for (const auto& detection : detections) {
+        const auto& face = detection.rect;
+        rects.push_back(cv::Rect(face.left(), face.top(), face.width(), face.height()));
+        scores.push_back(detection.detection_confidence);
+    }
+    return rects;
+}
+
+std::vector<std::vector<Point>> HeadPoseEstimation::fitFaces(cv::InputArray image, const std::vector<cv::Rect>& rects)
+{
+    return fitFaces(image, rects, std::vector<double>(), Clock::now());
+}
+
+std::vector<std::vector<Point>> HeadPoseEstimation::fitFaces(cv::InputArray image,
+                                                             const std::vector<cv::Rect>& rects,
+                                                             const std::vector<double>& scores)
+{
+    return fitFaces(image, rects, scores, Clock::now());
+}
+
+std::vector<std::vector<Point>> HeadPoseEstimation::fitFaces(cv::InputArray _image,
+                                                             const std::vector<cv::Rect>& _rects,
+                                                             const std::vector<double>& _scores,
+                                                             Clock::time_point start)
+{
     Mat image = _image.getMat();
 
     if (opticalCenterX == -1) // not initialized yet
@@ -47,19 +198,259 @@ std::vector<std::vector<Point>> HeadPoseEstimation::update(cv::InputArray _image
 #endif
     }
 
-    // intermediate value to avoid potential compilation error:
-    //     conversion from ‘const cv::Mat’ to non-scalar type ‘IplImage’
     auto ipl_img = cvIplImage(image);
     current_image = cv_image<bgr_pixel>(&ipl_img);
 
-    faces = detector(current_image);
+    const bool has_scores = _scores.size() == _rects.size();
+    const bool gated = qualityPolicy != QUALITY_OFF;
+
+    // quality gate, before the costly fitting of the facial features
+    std::vector<cv::Rect> rects;
+    std::vector<double> scores;
+    std::vector<FaceQuality> qualities;
+    nb_rejected = 0;
+    for (size_t i = 0; i < _rects.size(); ++i) {
+        FaceQuality quality = {0, 0, 0, true};
+        if (gated) {
+            quality = faceQuality(image, _rects[i], qualityThresholds);
+            if (!quality.acceptable && qualityPolicy == QUALITY_SKIP) {
+                ++nb_rejected;
+                continue;
+            }
+        }
+        rects.push_back(_rects[i]);
+        if (has_scores) scores.push_back(_scores[i]);
+        qualities.push_back(quality);
+    }
+
+    faces.clear();
+    shapes.clear();
+    face_scores = scores;
+    face_qualities = gated ? qualities : std::vector<FaceQuality>();
+    face_extrapolated.assign(rects.size(), false);
+    nb_deferred = 0;
+
+    if (timeBudget <= 0) {
+        previous_faces.clear();
+
+        // Find the pose of each face.
+        for (const auto& rect : rects) {
+            faces.push_back(toDlib(rect));
+            shapes.push_back((*pose_model)(current_image, faces.back()));
+        }
+
+        return features();
+    }
+
+    std::vector<dlib::rectangle> candidates;
+    for (const auto& rect : rects) candidates.push_back(toDlib(rect));
+
+    std::vector<PreviousFace> current(candidates.size());
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        current[i].rect = candidates[i];
+        current[i].score = has_scores ? scores[i] : 0;
+        current[i].quality = qualities[i];
+        current[i].fitted = false;
+        current[i].has_shape = false;
+    }
+
+    // fit the faces in order of priority, while the budget allows it
+    // (keeping some time for the poses of all the faces)
+    const auto reserved_for_poses = candidates.size() * pose_cost;
+    bool first = true;
+    for (auto i : rank(candidates)) {
+        const auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        if (!first && elapsed + fit_cost + reserved_for_poses > timeBudget) break;
+        first = false;
+
+        const auto fit_start = Clock::now();
+        current[i].shape = (*pose_model)(current_image, candidates[i]);
+        current[i].fitted = current[i].has_shape = true;
+
+        const auto cost = std::chrono::duration<double>(Clock::now() - fit_start).count();
+        fit_cost = fit_cost > 0 ? 0.8 * fit_cost + 0.2 * cost : cost;
+    }
+
+    // extrapolate the others from the previous frame, if they were there
+    for (auto& face : current) {
+        if (face.has_shape) continue;
+
+        auto previous = previousFace(face.rect);
+        if (previous < 0 || !previous_faces[previous].has_shape) continue;
+
+        const auto& previous_face = previous_faces[previous];
+        const double scale = double(face.rect.width()) / previous_face.rect.width();
+        std::vector<dlib::point> parts;
+        for (unsigned long j = 0; j < previous_face.shape.num_parts(); ++j) {
+            const auto& part = previous_face.shape.part(j);
+            parts.push_back(dlib::point(face.rect.left() + (part.x() - previous_face.rect.left()) * scale,
+                                        face.rect.top() + (part.y() - previous_face.rect.top()) * scale));
+        }
+        face.shape = full_object_detection(face.rect, parts);
+        face.has_shape = true;
+    }
+
+    // the served faces, in detection order
+    face_extrapolated.clear();
+    face_scores.clear();
+    face_qualities.clear();
+    for (const auto& face : current) {
+        if (!face.has_shape) {
+            ++nb_deferred;
+            continue;
+        }
+        faces.push_back(face.rect);
+        if (has_scores) face_scores.push_back(face.score);
+        if (gated) face_qualities.push_back(face.quality);
+        shapes.push_back(face.shape);
+        face_extrapolated.push_back(!face.fitted);
+    }
+
+    previous_faces = std::move(current);
+
+    return features();
+}
+
+FaceQuality HeadPoseEstimation::faceQuality(const Mat& image, const cv::Rect& face, const QualityThresholds& thresholds)
+{
+    FaceQuality quality = {std::min(face.width, face.height), 0, 0, false};
+
+    const auto roi = face & cv::Rect(0, 0, image.cols, image.rows);
+    if (roi.area() == 0) return quality;
+
+    // at a fixed scale, so that the sharpness does not depend on the size
+    // of the face (and the cost remains small)
+    const int width = 64;
+    Mat resized, grey, laplacian;
+    resize(image(roi), resized, Size(width, std::max(1, roi.height * width / roi.width)), 0, 0, INTER_AREA);
+    cvtColor(resized, grey, COLOR_BGR2GRAY);
+    Laplacian(grey, laplacian, CV_32F);
+
+    Scalar mean, stddev;
+    meanStdDev(laplacian, mean, stddev);
+    quality.sharpness = stddev[0] * stddev[0];
+    quality.brightness = cv::mean(grey)[0];
+
+    quality.acceptable = quality.size >= thresholds.min_size
+                         && quality.sharpness >= thresholds.min_sharpness
+                         && quality.brightness >= thresholds.min_brightness
+                         && quality.brightness <= thresholds.max_brightness;
+    return quality;
+}
+
+int HeadPoseEstimation::previousFace(const dlib::rectangle& rect) const
+{
+    int best = -1;
+    double best_overlap = 0.3; // intersection over union
+    for (size_t i = 0; i < previous_faces.size(); ++i) {
+        const auto& previous = previous_faces[i].rect;
+        const double intersection = rect.intersect(previous).area();
+        const double overlap = intersection / (rect.area() + previous.area() - intersection);
+        if (overlap > best_overlap) {
+            best = i;
+            best_overlap = overlap;
+        }
+    }
+    return best;
+}
+
+std::vector<size_t> HeadPoseEstimation::rank(const std::vector<dlib::rectangle>& rects) const
+{
+    std::vector<size_t> order(rects.size());
+    std::iota(order.begin(), order.end(), 0);
+
+    // the faces left out (or extrapolated) in the previous frame first, so
+    // that no face is starved; then by priority
+    std::vector<int> stale(rects.size()), tracked(rects.size());
+    for (size_t i = 0; i < rects.size(); ++i) {
+        auto previous = previousFace(rects[i]);
+        tracked[i] = previous >= 0;
+        stale[i] = previous >= 0 && !previous_faces[previous].fitted;
+    }
+
+    auto distance_to_center = [this](const dlib::rectangle& rect) {
+        const auto c = dlib::center(rect);
+        return std::hypot(c.x() - opticalCenterX, c.y() - opticalCenterY);
+    };
+
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        if (stale[a] != stale[b]) return stale[a] > stale[b];
+        switch (facePriority) {
+            case TRACKED_FIRST:
+                if (tracked[a] != tracked[b]) return tracked[a] > tracked[b];
+                return rects[a].area() > rects[b].area();
+            case CENTERED_FIRST:
+                return distance_to_center(rects[a]) < distance_to_center(rects[b]);
+            case LARGEST_FIRST:
+            default:
+                return rects[a].area() > rects[b].area();
+        }
+    });
+    return order;
+}
+
+std::vector<std::vector<Point>> HeadPoseEstimation::update(cv::InputArray _reduced_image,
+                                                           float scale,
+                                                           const std::function<Mat()>& full_resolution_image,
+                                                           unsigned long min_face_size)
+{
+    Mat reduced_image = _reduced_image.getMat();
+
+    if (opticalCenterX == -1) // not initialized yet
+    {
+        opticalCenterX = reduced_image.cols / scale / 2;
+        opticalCenterY = reduced_image.rows / scale / 2;
+#ifdef HEAD_POSE_ESTIMATION_DEBUG
+        cerr << "Setting the optical center to (" << opticalCenterX << ", " << opticalCenterY << ")" << endl;
+#endif
+    }
+
+    auto ipl_img = cvIplImage(reduced_image);
+    current_image = cv_image<bgr_pixel>(&ipl_img);
+
+    std::vector<rect_detection> detections;
+    detector(current_image, detections, detectionThreshold);
 
-    // Find the pose of each face.
+    // only decoded if a face is too small to be fitted on the reduced image
+    Mat full_image;
+    IplImage full_ipl_img;
+    cv_image<bgr_pixel> full_dlib_image;
+    bool full_image_requested = false;
+
+    faces.clear();
     shapes.clear();
-    for (auto face : faces){
-        shapes.push_back(pose_model(current_image, face));
+    face_scores.clear();
+    face_qualities.clear();
+    nb_deferred = 0;
+    nb_rejected = 0;
+    for (const auto& detection : detections) {
+        const auto& face = detection.rect;
+        faces.push_back(scaled(face, 1 / scale));
+        face_scores.push_back(detection.detection_confidence);
+
+        if (face.width() < min_face_size && !full_image_requested) {
+            full_image_requested = true;
+            full_image = full_resolution_image ? full_resolution_image() : Mat();
+            if (!full_image.empty()) {
+                full_ipl_img = cvIplImage(full_image);
+                full_dlib_image = cv_image<bgr_pixel>(&full_ipl_img);
+            }
+        }
+
+        if (face.width() < min_face_size && !full_image.empty()) {
+            shapes.push_back((*pose_model)(full_dlib_image, faces.back()));
+        }
+        else {
+            shapes.push_back(scaled((*pose_model)(current_image, face), 1 / scale));
+        }
     }
+    face_extrapolated.assign(faces.size(), false);
+
+    return features();
+}
 
+std::vector<std::vector<Point>> HeadPoseEstimation::features() const
+{
     std::vector<std::vector<Point>> all_features;
 
     for (size_t j = 0; j < shapes.size(); ++j)
@@ -78,7 +469,25 @@ std::vector<std::vector<Point>> HeadPoseEstimation::update(cv::InputArray _image
     return all_features;
 }
 
+std::vector<cv::Rect> HeadPoseEstimation::detections() const
+{
+    std::vector<cv::Rect> rects;
+    for (const auto& face : faces) {
+        rects.push_back(cv::Rect(face.left(), face.top(), face.width(), face.height()));
+    }
+    return rects;
+}
+
 head_pose HeadPoseEstimation::pose(size_t face_idx) const
+{
+    std::vector<Point> features;
+    for (size_t i = 0; i < 68; ++i) {
+        features.push_back(toCv(shapes[face_idx].part(i)));
+    }
+    return poseFromFeatures(features);
+}
+
+head_pose HeadPoseEstimation::poseFromFeatures(const std::vector<Point>& features) const
 {
 
     cv::Mat projectionMat = cv::Mat::zeros(3,3,CV_32F);
@@ -102,15 +511,15 @@ head_pose HeadPoseEstimation::pose(size_t face_idx) const
 
     std::vector<Point2f> detected_points;
 
-    detected_points.push_back(coordsOf(face_idx, SELLION));
-    detected_points.push_back(coordsOf(face_idx, RIGHT_EYE));
-    detected_points.push_back(coordsOf(face_idx, LEFT_EYE));
-    detected_points.push_back(coordsOf(face_idx, RIGHT_SIDE));
-    detected_points.push_back(coordsOf(face_idx, LEFT_SIDE));
-    detected_points.push_back(coordsOf(face_idx, MENTON));
-    detected_points.push_back(coordsOf(face_idx, NOSE));
+    detected_points.push_back(Point2f(features[SELLION]));
+    detected_points.push_back(Point2f(features[RIGHT_EYE]));
+    detected_points.push_back(Point2f(features[LEFT_EYE]));
+    detected_points.push_back(Point2f(features[RIGHT_SIDE]));
+    detected_points.push_back(Point2f(features[LEFT_SIDE]));
+    detected_points.push_back(Point2f(features[MENTON]));
+    detected_points.push_back(Point2f(features[NOSE]));
 
-    auto stomion = (coordsOf(face_idx, MOUTH_CENTER_TOP) + coordsOf(face_idx, MOUTH_CENTER_BOTTOM)) * 0.5;
+    auto stomion = (Point2f(features[MOUTH_CENTER_TOP]) + Point2f(features[MOUTH_CENTER_BOTTOM])) * 0.5;
     detected_points.push_back(stomion);
 
 
@@ -147,10 +556,17 @@ std::vector<head_pose> HeadPoseEstimation::poses() const {
 
     std::vector<head_pose> res;
 
+    const auto start = Clock::now();
+
     for (auto i = 0; i < faces.size(); i++){
         res.push_back(pose(i));
     }
 
+    if (timeBudget > 0 && !faces.empty()) {
+        const auto cost = std::chrono::duration<double>(Clock::now() - start).count() / faces.size();
+        pose_cost = pose_cost > 0 ? 0.8 * pose_cost + 0.2 * cost : cost;
+    }
+
     return res;
 
 }
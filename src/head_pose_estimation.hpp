@@ -9,6 +9,9 @@
 #include <vector>
 #include <array>
 #include <string>
+#include <memory>
+#include <functional>
+#include <chrono>
 
 
 // ****** Anthorpometrics of the head ******
@@ -74,10 +77,56 @@ enum FACIAL_FEATURE {
 
 typedef cv::Matx44d head_pose;
 
+/** Cheap estimate of how useful a detected face is, before its facial
+ * features are fitted (see HeadPoseEstimation::faceQuality()).
+ */
+struct FaceQuality {
+    int size;          // smaller side of the bounding box, in pixels
+    double sharpness;  // variance of the Laplacian of the face, at a fixed scale
+    double brightness; // mean grey level of the face (0-255)
+    bool acceptable;   // all of the above are within the thresholds
+};
+
+/** Thresholds of the face quality gate. The defaults suit typical indoor
+ * cameras; tune them on the cameras at hand.
+ */
+struct QualityThresholds {
+    QualityThresholds() : min_size(40), min_sharpness(20), min_brightness(30), max_brightness(225) {}
+
+    int min_size;
+    double min_sharpness;
+    double min_brightness;
+    double max_brightness;
+};
+
+/** Detects faces and estimates their 3D pose.
+ *
+ * An estimator is not thread-safe. To process images in parallel, use one
+ * estimator per thread: copies of an estimator share the (read-only) facial
+ * landmarks model, so they are cheap to create.
+ */
 class HeadPoseEstimation {
 
 public:
 
+    /** Order in which the faces are processed when the time budget is
+     * limited (see timeBudget).
+     */
+    enum FacePriority {
+        LARGEST_FIRST,  // the largest (ie, nearest) faces first
+        TRACKED_FIRST,  // the faces already seen in the previous frame first
+        CENTERED_FIRST  // the faces closest to the optical center first
+    };
+
+    /** What to do with the faces that do not pass the quality gate (see
+     * qualityPolicy).
+     */
+    enum QualityPolicy {
+        QUALITY_OFF,  // no quality gate
+        QUALITY_FLAG, // process them, and flag them in qualities()
+        QUALITY_SKIP  // discard them before their features are fitted
+    };
+
     HeadPoseEstimation(const std::string& face_detection_model = "shape_predictor_68_face_landmarks.dat", float focalLength=455.);
 
     /** Returns the 2D position (in image coordinates) of the 68 facial features
@@ -85,8 +134,140 @@ public:
      */
     std::vector<std::vector<cv::Point>> update(cv::InputArray image);
 
+    /** Same as update(), but the faces are only searched around the given
+     * regions: typically, the bounding boxes of persons found by a body
+     * detector, or blobs of a depth segmentation, in image coordinates. The
+     * faces are searched in the upper part of each region (the whole region
+     * if it is not taller than wide), with a margin. Regions that overlap
+     * are searched at once.
+     *
+     * If `full_frame_period` is 0, the full frame is never scanned: faces
+     * outside of the hints are not found. Otherwise, one call out of
+     * `full_frame_period` (starting with the first one) scans the full
+     * frame instead, eg to find the persons missed by the body detector.
+     */
+    std::vector<std::vector<cv::Point>> update(cv::InputArray image,
+                                               const std::vector<cv::Rect>& hints,
+                                               unsigned int full_frame_period = 0);
+
+    /** First stage of update(): only detects the faces, without changing
+     * the state of the estimator.
+     */
+    std::vector<cv::Rect> detectFaces(cv::InputArray image);
+
+    /** Same as detectFaces(), and also returns the detection confidence of
+     * each face (see detectionThreshold).
+     */
+    std::vector<cv::Rect> detectFaces(cv::InputArray image, std::vector<double>& scores);
+
+    /** Same as detectFaces(), but only searches the faces in the given
+     * regions of the image (see update() with hints).
+     */
+    std::vector<cv::Rect> detectFaces(cv::InputArray image,
+                                      const std::vector<cv::Rect>& regions,
+                                      std::vector<double>& scores);
+
+    /** The regions searched by update() with hints: the upper part of each
+     * hint, with a margin, clipped to the image. Overlapping regions are
+     * merged.
+     */
+    static std::vector<cv::Rect> searchRegions(const std::vector<cv::Rect>& hints, cv::Size image_size);
+
+    /** Second stage of update(): fits the facial features of the given
+     * faces (typically, found by detectFaces() on the same image, possibly
+     * by another estimator), as update() would. Then poses() returns their
+     * poses.
+     */
+    std::vector<std::vector<cv::Point>> fitFaces(cv::InputArray image, const std::vector<cv::Rect>& faces);
+
+    /** Same as fitFaces(), with the detection confidence of the faces, then
+     * returned by scores().
+     */
+    std::vector<std::vector<cv::Point>> fitFaces(cv::InputArray image,
+                                                 const std::vector<cv::Rect>& faces,
+                                                 const std::vector<double>& scores);
+
+    typedef std::chrono::steady_clock Clock;
+
+    /** Same as fitFaces(), with the time budget (see timeBudget) counted
+     * from `start` instead of from the call: eg, the time the faces were
+     * detected from, by another detector. `scores` may be empty.
+     */
+    std::vector<std::vector<cv::Point>> fitFaces(cv::InputArray image,
+                                                 const std::vector<cv::Rect>& faces,
+                                                 const std::vector<double>& scores,
+                                                 Clock::time_point start);
+
+    /** For each face of the last update() (or fitFaces()), whether its
+     * features were extrapolated from the previous frame instead of being
+     * fitted, to meet the time budget.
+     */
+    std::vector<bool> extrapolated() const {return face_extrapolated;}
+
+    /** Number of faces detected by the last update() (or passed to
+     * fitFaces()) that were left out to meet the time budget.
+     */
+    size_t nbDeferred() const {return nb_deferred;}
+
+    /** For each face of the last update() (or fitFaces()), its quality, if
+     * the quality gate is on (see qualityPolicy).
+     */
+    std::vector<FaceQuality> qualities() const {return face_qualities;}
+
+    /** Number of faces detected by the last update() (or passed to
+     * fitFaces()) that were discarded by the quality gate.
+     */
+    size_t nbRejected() const {return nb_rejected;}
+
+    /** Quality of a face (bounding box in image coordinates) of a BGR image,
+     * against the given thresholds. The sharpness is measured on the face
+     * resized to a fixed width, so that it does not depend on its size: the
+     * cost is small and constant.
+     */
+    static FaceQuality faceQuality(const cv::Mat& image,
+                                   const cv::Rect& face,
+                                   const QualityThresholds& thresholds = QualityThresholds());
+
+    /** Same as update(), but the faces are detected on a downscaled image
+     * (typically, a JPEG decoded at 1/2 or 1/4 of its resolution, see
+     * reduced_decoding.hpp). `scale` is the size of `reduced_image` relative
+     * to the full-resolution image (eg, 0.5).
+     *
+     * The facial features of the faces that are at least `min_face_size`
+     * pixels wide in the reduced image are fitted on the reduced image.
+     * For smaller faces, `full_resolution_image` is called (at most once) to
+     * get the full-resolution image, and their features are fitted on it.
+     * The width is compared in the reduced image, where the detector does
+     * not find faces narrower than about 80 pixels: `min_face_size` must be
+     * above that for the full-resolution fitting to ever happen.
+     *
+     * The returned features (and the poses) are in full-resolution image
+     * coordinates.
+     */
+    std::vector<std::vector<cv::Point>> update(cv::InputArray reduced_image,
+                                               float scale,
+                                               const std::function<cv::Mat()>& full_resolution_image,
+                                               unsigned long min_face_size = 120);
+
+    /** Returns the bounding boxes of the faces detected by the last update(),
+     * in (full resolution) image coordinates.
+     */
+    std::vector<cv::Rect> detections() const;
+
+    /** Returns the detection confidence of the faces detected by the last
+     * update(), in the order of detections(). Empty if the faces were
+     * passed to fitFaces() without their confidence.
+     */
+    std::vector<double> scores() const {return face_scores;}
+
     head_pose pose(size_t face_idx) const;
 
+    /** Third stage of update()/poses(): the pose of a face, given its 68
+     * facial features (as returned by update() or fitFaces(), possibly by
+     * another estimator). Only depends on the camera parameters.
+     */
+    head_pose poseFromFeatures(const std::vector<cv::Point>& features) const;
+
     std::vector<head_pose> poses() const;
 
     /** Returns an augmented image with the detected facial features and head pose drawn in.
@@ -99,18 +280,87 @@ public:
     float opticalCenterX;
     float opticalCenterY;
 
+    /** If > 0, time budget (in seconds) of update() followed by poses().
+     *
+     * The faces are then processed in the order given by facePriority,
+     * until the budget would be exceeded (the first face is always
+     * processed). The remaining faces are extrapolated from the previous
+     * frame when they were already there (their previous features, moved
+     * and scaled like their bounding box), and deferred otherwise: they
+     * are left out of this frame, and processed first in the next one.
+     *
+     * Does not apply to the reduced resolution update().
+     */
+    float timeBudget;
+    FacePriority facePriority;
+
+    /** Minimum detection confidence of a face (0 by default, as dlib).
+     *
+     * The faces detected with a lower confidence are discarded before their
+     * facial features are fitted: raise it to skip the marginal detections
+     * (often false positives) of cluttered scenes. Negative values find more
+     * faces, at the cost of more false positives.
+     */
+    float detectionThreshold;
+
+    /** Quality gate, between face detection and the fitting of the facial
+     * features: the blurry, tiny, under- or over-exposed faces (see
+     * qualityThresholds) give useless features and poses, at the same cost
+     * as the others. QUALITY_OFF by default.
+     *
+     * Does not apply to the reduced resolution update().
+     */
+    QualityPolicy qualityPolicy;
+    QualityThresholds qualityThresholds;
+
 private:
 
+    /** Order in which the faces should be processed, given the priority
+     * policy and the previous frame.
+     */
+    std::vector<size_t> rank(const std::vector<dlib::rectangle>& rects) const;
+
+    /** Index of the face of the previous frame matching `rect`, or -1.
+     */
+    int previousFace(const dlib::rectangle& rect) const;
+
+    struct PreviousFace {
+        dlib::rectangle rect;
+        double score;
+        FaceQuality quality;
+        bool fitted;      // false if extrapolated, or deferred
+        bool has_shape;   // false if deferred
+        dlib::full_object_detection shape;
+    };
+
+    std::vector<PreviousFace> previous_faces;
+
+    unsigned long nb_hinted_updates;
+    std::vector<bool> face_extrapolated;
+    size_t nb_deferred;
+
+    std::vector<FaceQuality> face_qualities; // empty if the quality gate is off
+    size_t nb_rejected;
+
+    // running averages of the cost of one face, in seconds
+    double fit_cost;
+    mutable double pose_cost;
+
     dlib::cv_image<dlib::bgr_pixel> current_image;
 
     dlib::frontal_face_detector detector;
-    dlib::shape_predictor pose_model;
+    std::shared_ptr<const dlib::shape_predictor> pose_model;
 
     std::vector<dlib::rectangle> faces;
+    std::vector<double> face_scores; // empty if unknown
 
     std::vector<dlib::full_object_detection> shapes;
 
 
+    /** Returns the 2D position of the facial features of the current shapes.
+     */
+    std::vector<std::vector<cv::Point>> features() const;
+
     void drawFeatures(const std::vector<std::vector<cv::Point>>& detected_features, cv::Mat& result) const;
 
     void drawPose(const head_pose& detected_pose, size_t face_idx, cv::Mat& result) const;
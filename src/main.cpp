@@ -23,6 +23,15 @@ int main(int argc, char* argv[])
     bool enableDepth;
     _private_node.param<bool>("with_depth", enableDepth, false);
 
+    // if 2, 4 or 8: subscribe to the compressed (JPEG) stream, and decode it
+    // that many times smaller for face detection
+    int reducedDecoding;
+    _private_node.param<int>("reduced_decoding", reducedDecoding, 1);
+
+    // if not empty, also publish the results in that shared memory segment
+    string shmResults;
+    _private_node.param<string>("shm_results", shmResults, "");
+
     if (modelFilename.empty()) {
         ROS_ERROR_STREAM("You must provide the face model with the parameter face_model.\n" <<
                          "For instance, _face_model:=shape_predictor_68_face_landmarks.dat");
@@ -32,7 +41,7 @@ int main(int argc, char* argv[])
     // initialize the detector by subscribing to the camera video stream
     ROS_INFO_STREAM("Initializing the face detector with the model " << modelFilename <<"...");
     if(!enableDepth) {
-        HeadPoseEstimator estimator(rosNode, prefix, modelFilename);
+        HeadPoseEstimator estimator(rosNode, prefix, modelFilename, reducedDecoding, shmResults);
         ROS_INFO_STREAM("RGB-only estimator successfully initialized." << endl <<
                         "TF frames of detected faces will be published when detected," << endl <<
                         "as well as the nb of detected faces on /nb_detected_faces.");
@@ -0,0 +1,249 @@
+#include <limits>
+
+#include "multi_stream_runtime.hpp"
+
+using namespace std;
+
+MultiStreamRuntime::MultiStreamRuntime(const HeadPoseEstimation& prototype, size_t nb_workers) :
+    estimators(max<size_t>(nb_workers, 1), prototype),
+    nb_served(0),
+    stopping(false)
+{
+    for (size_t i = 0; i < estimators.size(); ++i) {
+        // consecutive frames of a worker come from different streams: no
+        // extrapolation from the previous frame
+        estimators[i].timeBudget = 0;
+        workers.emplace_back([this, i] {work(i);});
+    }
+}
+
+MultiStreamRuntime::~MultiStreamRuntime()
+{
+    {
+        lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+    for (auto& worker : workers) worker.join();
+}
+
+size_t MultiStreamRuntime::addStream(const StreamConfig& config, const Callback& callback)
+{
+    unique_ptr<Stream> stream(new Stream);
+    stream->config = config;
+    stream->config.queue_size = max<size_t>(config.queue_size, 1);
+    stream->callback = callback;
+    stream->busy = false;
+    stream->last_served = 0;
+    stream->added = Clock::now();
+    stream->submitted = stream->processed = stream->dropped = stream->expired = 0;
+    stream->total_latency = 0;
+
+    lock_guard<std::mutex> lock(mutex);
+    streams.push_back(move(stream));
+    return streams.size() - 1;
+}
+
+bool MultiStreamRuntime::submit(size_t stream_idx, const cv::Mat& image, double timestamp)
+{
+    Frame frame;
+    frame.image = image.clone();
+    frame.timestamp = timestamp;
+    frame.submitted = Clock::now();
+
+    vector<Dropped> dropped;
+    {
+        lock_guard<std::mutex> lock(mutex);
+        if (stream_idx >= streams.size()) return false;
+        auto& stream = *streams[stream_idx];
+
+        frame.idx = stream.submitted++;
+        if (stream.pending.size() < stream.config.queue_size) {
+            stream.pending.push_back(move(frame));
+        }
+        else if (stream.config.drop_policy == AsyncHeadPoseEstimation::DROP_OLDEST) {
+            dropped.push_back({stream_idx, stream.pending.front().idx, stream.pending.front().timestamp});
+            stream.pending.pop_front();
+            stream.pending.push_back(move(frame));
+            ++stream.dropped;
+        }
+        else {
+            dropped.push_back({stream_idx, frame.idx, frame.timestamp});
+            ++stream.dropped;
+        }
+    }
+    condition.notify_one();
+
+    notifyDropped(dropped);
+    return true;
+}
+
+bool MultiStreamRuntime::pick(size_t& stream_idx, Frame& frame, vector<Dropped>& expired)
+{
+    const auto now = Clock::now();
+
+    bool found = false;
+    int best_priority = 0;
+    uint64_t best_last_served = 0;
+
+    for (size_t i = 0; i < streams.size(); ++i) {
+        auto& stream = *streams[i];
+        if (stream.busy) continue;
+
+        if (stream.config.deadline > 0) {
+            const auto deadline = chrono::duration_cast<Clock::duration>(chrono::duration<double>(stream.config.deadline));
+            while (!stream.pending.empty() && stream.pending.front().submitted + deadline < now) {
+                expired.push_back({i, stream.pending.front().idx, stream.pending.front().timestamp});
+                stream.pending.pop_front();
+                ++stream.expired;
+            }
+        }
+        if (stream.pending.empty()) continue;
+
+        bool better = !found ||
+                      stream.config.priority > best_priority ||
+                      (stream.config.priority == best_priority && stream.last_served < best_last_served);
+        if (better) {
+            found = true;
+            stream_idx = i;
+            best_priority = stream.config.priority;
+            best_last_served = stream.last_served;
+        }
+    }
+
+    if (!found) return false;
+
+    auto& stream = *streams[stream_idx];
+    frame = move(stream.pending.front());
+    stream.pending.pop_front();
+    stream.busy = true;
+    stream.last_served = ++nb_served;
+    return true;
+}
+
+void MultiStreamRuntime::work(size_t worker_idx)
+{
+    auto& estimator = estimators[worker_idx];
+    const auto default_focal_length = estimator.focalLength;
+
+    while (true) {
+        size_t stream_idx = 0;
+        Frame frame;
+        StreamConfig config;
+        Callback callback;
+        shared_ptr<BatchedDetector> batched_detector;
+        vector<Dropped> expired;
+        bool picked = false;
+        {
+            unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [&] {
+                picked = pick(stream_idx, frame, expired);
+                if (picked || !expired.empty()) return true;
+                if (!stopping) return false;
+                // stopping: only wait for the frames of the busy streams
+                for (const auto& stream : streams) {
+                    if (!stream->pending.empty()) return false;
+                }
+                return true;
+            });
+            if (!picked && expired.empty()) break;
+            if (picked) {
+                config = streams[stream_idx]->config;
+                callback = streams[stream_idx]->callback;
+                batched_detector = detector;
+            }
+        }
+
+        notifyDropped(expired);
+        if (!picked) continue; // only expired frames
+
+        estimator.focalLength = config.focal_length > 0 ? config.focal_length : default_focal_length;
+        estimator.opticalCenterX = config.optical_center_x >= 0 ? config.optical_center_x : frame.image.cols / 2;
+        estimator.opticalCenterY = config.optical_center_y >= 0 ? config.optical_center_y : frame.image.rows / 2;
+
+        AsyncResult result;
+        result.frame_idx = frame.idx;
+        result.timestamp = frame.timestamp;
+        result.dropped = false;
+        try {
+            if (batched_detector) {
+                // no detection confidence: result.scores stays empty
+                result.features = estimator.fitFaces(frame.image, batched_detector->detect(frame.image));
+            }
+            else {
+                result.features = estimator.update(frame.image);
+            }
+            result.faces = estimator.detections();
+            result.scores = estimator.scores();
+            result.poses = estimator.poses();
+        }
+        catch (...) {
+            // no results for this frame, but the stream goes on
+            result = AsyncResult();
+            result.frame_idx = frame.idx;
+            result.timestamp = frame.timestamp;
+            result.dropped = true;
+        }
+
+        if (callback) callback(stream_idx, result);
+
+        {
+            lock_guard<std::mutex> lock(mutex);
+            auto& stream = *streams[stream_idx];
+            stream.busy = false;
+            ++stream.processed;
+            stream.total_latency += chrono::duration<double>(Clock::now() - frame.submitted).count();
+        }
+        // the stream might have more frames, for any worker
+        condition.notify_all();
+    }
+}
+
+void MultiStreamRuntime::notifyDropped(const vector<Dropped>& dropped)
+{
+    for (const auto& frame : dropped) {
+        Callback callback;
+        {
+            lock_guard<std::mutex> lock(mutex);
+            callback = streams[frame.stream]->callback;
+        }
+        if (!callback) continue;
+
+        AsyncResult result;
+        result.frame_idx = frame.idx;
+        result.timestamp = frame.timestamp;
+        result.dropped = true;
+        callback(frame.stream, result);
+    }
+}
+
+void MultiStreamRuntime::setDetector(const shared_ptr<BatchedDetector>& batched_detector)
+{
+    lock_guard<std::mutex> lock(mutex);
+    detector = batched_detector;
+}
+
+StreamStats MultiStreamRuntime::stats(size_t stream_idx) const
+{
+    StreamStats stats = {};
+
+    lock_guard<std::mutex> lock(mutex);
+    if (stream_idx >= streams.size()) return stats;
+    const auto& stream = *streams[stream_idx];
+
+    stats.submitted = stream.submitted;
+    stats.processed = stream.processed;
+    stats.dropped = stream.dropped;
+    stats.expired = stream.expired;
+
+    const auto elapsed = chrono::duration<double>(Clock::now() - stream.added).count();
+    stats.fps = elapsed > 0 ? stream.processed / elapsed : 0;
+    stats.latency = stream.processed > 0 ? stream.total_latency / stream.processed : 0;
+    return stats;
+}
+
+size_t MultiStreamRuntime::nbStreams() const
+{
+    lock_guard<std::mutex> lock(mutex);
+    return streams.size();
+}
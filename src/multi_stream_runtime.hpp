@@ -0,0 +1,176 @@
+#ifndef __MULTI_STREAM_RUNTIME
+#define __MULTI_STREAM_RUNTIME
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <memory>
+#include <cstdint>
+
+#include "head_pose_estimation.hpp"
+#include "async_head_pose_estimation.hpp" // AsyncResult
+#include "batched_detector.hpp"
+
+/** Scheduling parameters of one stream of a MultiStreamRuntime.
+ */
+struct StreamConfig {
+    StreamConfig() :
+        priority(0),
+        deadline(0),
+        queue_size(2),
+        drop_policy(AsyncHeadPoseEstimation::DROP_OLDEST),
+        focal_length(-1),
+        optical_center_x(-1),
+        optical_center_y(-1)
+    {}
+
+    /** The frames of the streams with the highest priority are always
+     * processed first.
+     */
+    int priority;
+
+    /** If > 0, a frame that could not be started within `deadline` seconds
+     * of its submission is dropped (it would be too late to be useful).
+     */
+    double deadline;
+
+    /** Frames waiting to be processed; when full, the oldest (or newest)
+     * one is dropped.
+     */
+    size_t queue_size;
+    AsyncHeadPoseEstimation::DropPolicy drop_policy;
+
+    /** Camera parameters, in pixels: by default, the focal length of the
+     * prototype estimator, and the center of the frames.
+     */
+    float focal_length;
+    float optical_center_x;
+    float optical_center_y;
+};
+
+/** Counters of one stream, since it was added.
+ */
+struct StreamStats {
+    uint64_t submitted;
+    uint64_t processed;
+    uint64_t dropped; // queue full
+    uint64_t expired; // deadline missed
+    double fps;       // processed frames per second
+    double latency;   // average time between submission and results, in seconds
+};
+
+/** Head pose estimation for many streams (typically, all the cameras of a
+ * host) with a single model and a single pool of `nb_workers` threads,
+ * instead of one estimator per camera fighting over the cores.
+ *
+ * A free worker takes the next frame of the stream with the highest
+ * priority; among equal priorities, of the stream that was served least
+ * recently (round robin), so that no stream starves the others. Frames
+ * past the deadline of their stream are dropped instead.
+ *
+ * The frames of a given stream are processed one at a time, so that its
+ * results are delivered in order: the parallelism comes from the streams
+ * (use AsyncHeadPoseEstimation to pipeline a single stream).
+ *
+ * The `frame_idx` of the results is the index of the frame among those
+ * submitted to its stream. Callbacks are called from the workers (or from submit() for the frames
+ * dropped because the queue of their stream is full), with `dropped` set
+ * if the frame was dropped, or if its processing failed (eg, the batched
+ * detector threw).
+ */
+class MultiStreamRuntime {
+
+public:
+
+    typedef std::function<void(size_t stream, const AsyncResult& result)> Callback;
+
+    MultiStreamRuntime(const HeadPoseEstimation& prototype, size_t nb_workers);
+
+    /** Processes the frames already submitted (unless they expire), then
+     * stops the workers.
+     */
+    ~MultiStreamRuntime();
+
+    MultiStreamRuntime(const MultiStreamRuntime&) = delete;
+    MultiStreamRuntime& operator=(const MultiStreamRuntime&) = delete;
+
+    /** Adds a stream, and returns its index (for submit() and stats()).
+     */
+    size_t addStream(const StreamConfig& config, const Callback& callback);
+
+    /** Queues a (BGR) frame of a stream. The frame is copied. Returns false
+     * if the stream does not exist.
+     */
+    bool submit(size_t stream, const cv::Mat& frame, double timestamp = 0);
+
+    /** Detects the faces with `detector` instead of the estimators' own
+     * detector, eg to batch the frames of several streams in a single
+     * forward pass of the CNN detector (see cnn_face_detector.hpp). A batch
+     * can only be as large as the number of workers. The detection
+     * confidence is then unknown: AsyncResult::scores stays empty.
+     */
+    void setDetector(const std::shared_ptr<BatchedDetector>& detector);
+
+    StreamStats stats(size_t stream) const;
+
+    size_t nbStreams() const;
+
+    size_t nbWorkers() const {return workers.size();}
+
+private:
+
+    typedef std::chrono::steady_clock Clock;
+
+    struct Frame {
+        uint64_t idx;
+        cv::Mat image;
+        double timestamp;
+        Clock::time_point submitted;
+    };
+
+    struct Stream {
+        StreamConfig config;
+        Callback callback;
+
+        std::deque<Frame> pending;
+        bool busy; // one of its frames is being processed
+        uint64_t last_served;
+
+        Clock::time_point added;
+        uint64_t submitted, processed, dropped, expired;
+        double total_latency;
+    };
+
+    struct Dropped {
+        size_t stream;
+        uint64_t idx;
+        double timestamp;
+    };
+
+    void work(size_t worker_idx);
+
+    /** Picks the next frame to process (and drops the expired ones). Returns
+     * false if no stream has a frame ready.
+     */
+    bool pick(size_t& stream_idx, Frame& frame, std::vector<Dropped>& expired);
+
+    void notifyDropped(const std::vector<Dropped>& dropped);
+
+    std::vector<HeadPoseEstimation> estimators; // one per worker
+
+    mutable std::mutex mutex;
+    std::condition_variable condition;
+    std::vector<std::unique_ptr<Stream>> streams;
+    std::shared_ptr<BatchedDetector> detector;
+    uint64_t nb_served;
+    bool stopping;
+
+    std::vector<std::thread> workers;
+};
+
+#endif // __MULTI_STREAM_RUNTIME
@@ -0,0 +1,131 @@
+#include "pipeline_executor.hpp"
+
+using namespace std;
+
+PipelineExecutor::PipelineExecutor(const HeadPoseEstimation& prototype,
+                                   const Source& source,
+                                   const Sink& sink,
+                                   size_t queue_size) :
+    detector(prototype),
+    landmarker(prototype),
+    poser(prototype),
+    source(source),
+    sink(sink),
+    detected(max<size_t>(queue_size, 1)),
+    fitted(max<size_t>(queue_size, 1)),
+    detection_done(false),
+    landmarks_done(false),
+    start_time(Clock::now())
+{
+    detection_thread = thread([this] {detect();});
+    landmarks_thread = thread([this] {fitLandmarks();});
+    pose_thread = thread([this] {estimatePoses();});
+}
+
+PipelineExecutor::~PipelineExecutor()
+{
+    detection_thread.join();
+    landmarks_thread.join();
+    pose_thread.join();
+}
+
+void PipelineExecutor::detect()
+{
+    PipelineFrame frame;
+    while (source(frame)) {
+        auto start = Clock::now();
+        frame.faces = detector.detectFaces(frame.image, frame.scores);
+        account(stage_stats[DETECTION], start);
+
+        push(detected, frame);
+        frame = PipelineFrame();
+    }
+    detection_done = true;
+}
+
+void PipelineExecutor::fitLandmarks()
+{
+    PipelineFrame frame;
+    while (pop(detected, detection_done, stage_stats[LANDMARKS], frame)) {
+        auto start = Clock::now();
+        frame.features = landmarker.fitFaces(frame.image, frame.faces, frame.scores);
+        // without the faces left out to meet the time budget, if any
+        frame.faces = landmarker.detections();
+        frame.scores = landmarker.scores();
+        account(stage_stats[LANDMARKS], start);
+
+        push(fitted, frame);
+    }
+    landmarks_done = true;
+}
+
+void PipelineExecutor::estimatePoses()
+{
+    PipelineFrame frame;
+    while (pop(fitted, landmarks_done, stage_stats[POSE], frame)) {
+        auto start = Clock::now();
+        if (poser.opticalCenterX == -1) { // as update() would
+            poser.opticalCenterX = frame.image.cols / 2;
+            poser.opticalCenterY = frame.image.rows / 2;
+        }
+        for (const auto& features : frame.features) {
+            frame.poses.push_back(poser.poseFromFeatures(features));
+        }
+        account(stage_stats[POSE], start);
+
+        sink(frame);
+    }
+}
+
+bool PipelineExecutor::pop(SpscQueue<PipelineFrame>& queue, const atomic<bool>& upstream_done,
+                           StageStats& stats, PipelineFrame& frame)
+{
+    size_t nb_attempts = 0;
+    while (true) {
+        auto queued = queue.size();
+        if (queue.tryPop(frame)) {
+            stats.queued += queued > 0 ? queued - 1 : 0;
+            return true;
+        }
+        // checked *after* an empty queue: the last frames were pushed before
+        // the flag was set
+        if (upstream_done) return queue.tryPop(frame);
+        wait(nb_attempts);
+    }
+}
+
+void PipelineExecutor::push(SpscQueue<PipelineFrame>& queue, PipelineFrame& frame)
+{
+    size_t nb_attempts = 0;
+    while (!queue.tryPush(frame)) wait(nb_attempts);
+}
+
+void PipelineExecutor::wait(size_t& nb_attempts)
+{
+    // the stages take milliseconds: after a few attempts, sleeping a bit
+    // costs little latency, and leaves the CPU to the other stages
+    if (++nb_attempts < 64) this_thread::yield();
+    else this_thread::sleep_for(chrono::microseconds(100));
+}
+
+void PipelineExecutor::account(StageStats& stats, Clock::time_point start)
+{
+    stats.busy_ns += chrono::duration_cast<chrono::nanoseconds>(Clock::now() - start).count();
+    ++stats.nb_frames;
+}
+
+PipelineStats PipelineExecutor::stats() const
+{
+    PipelineStats result;
+    result.nb_frames = stage_stats[POSE].nb_frames;
+    result.elapsed = chrono::duration<double>(Clock::now() - start_time).count();
+
+    for (size_t i = 0; i < 3; ++i) {
+        result.busy[i] = result.elapsed > 0 ? stage_stats[i].busy_ns * 1e-9 / result.elapsed : 0;
+    }
+    for (size_t i = 0; i < 2; ++i) {
+        const auto& stats = stage_stats[i + 1];
+        result.queued[i] = stats.nb_frames > 0 ? double(stats.queued) / stats.nb_frames : 0;
+    }
+    return result;
+}
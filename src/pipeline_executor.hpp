@@ -0,0 +1,128 @@
+#ifndef __PIPELINE_EXECUTOR
+#define __PIPELINE_EXECUTOR
+
+#include <vector>
+#include <array>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <chrono>
+#include <cstdint>
+
+#include "head_pose_estimation.hpp"
+#include "spsc_queue.hpp"
+
+/** A frame going through the PipelineExecutor. Each stage fills in its
+ * results.
+ */
+struct PipelineFrame {
+    uint64_t id;
+    double timestamp;
+    cv::Mat image;
+
+    std::vector<cv::Rect> faces;                  // detection
+    std::vector<double> scores;                   // detection confidence of the faces
+    std::vector<std::vector<cv::Point>> features; // landmarks
+    std::vector<head_pose> poses;                 // pose
+};
+
+/** Occupancy of the pipeline, since it started.
+ */
+struct PipelineStats {
+    uint64_t nb_frames; // frames that went through the whole pipeline
+    double elapsed;     // seconds
+
+    /** Fraction of the time each stage (detection, landmarks, pose) spent
+     * processing frames. The slowest stage is close to 1, and bounds the
+     * throughput.
+     */
+    std::array<double, 3> busy;
+
+    /** Average number of frames waiting in front of the landmarks and pose
+     * stages (when the stage took its next frame).
+     */
+    std::array<double, 2> queued;
+};
+
+/** Runs the three stages of HeadPoseEstimation::update() and poses() on a
+ * single stream of frames, each stage on its own thread (and estimator,
+ * sharing the model of `prototype`): while the faces of frame N+2 are
+ * detected, the features of frame N+1 are fitted and the poses of frame N
+ * are computed. The results are exactly those of update() and poses().
+ *
+ * The stages are connected by lock-free single-producer single-consumer
+ * queues of `queue_size` frames. A stage with nothing to do first spins
+ * (yielding the CPU), then sleeps for short periods.
+ *
+ * `source` is called by the detection thread to get the next frame. It
+ * may block, and returns false when there are no more frames. `sink` is
+ * called by the pose thread with each processed frame, in order.
+ */
+class PipelineExecutor {
+
+public:
+
+    enum Stage {DETECTION, LANDMARKS, POSE};
+
+    typedef std::function<bool(PipelineFrame&)> Source;
+    typedef std::function<void(PipelineFrame&)> Sink;
+
+    PipelineExecutor(const HeadPoseEstimation& prototype,
+                     const Source& source,
+                     const Sink& sink,
+                     size_t queue_size = 4);
+
+    /** Waits for the source to run out of frames, and for all the frames to
+     * go through the pipeline.
+     */
+    ~PipelineExecutor();
+
+    PipelineExecutor(const PipelineExecutor&) = delete;
+    PipelineExecutor& operator=(const PipelineExecutor&) = delete;
+
+    PipelineStats stats() const;
+
+private:
+
+    typedef std::chrono::steady_clock Clock;
+
+    struct StageStats {
+        StageStats() : busy_ns(0), queued(0), nb_frames(0) {}
+        std::atomic<uint64_t> busy_ns;
+        std::atomic<uint64_t> queued;    // sum of the queue sizes seen by the stage
+        std::atomic<uint64_t> nb_frames;
+    };
+
+    void detect();
+    void fitLandmarks();
+    void estimatePoses();
+
+    /** Pops the next frame of `queue`, waiting if needed. Returns false
+     * once `upstream_done` is set and the queue is empty.
+     */
+    bool pop(SpscQueue<PipelineFrame>& queue, const std::atomic<bool>& upstream_done,
+             StageStats& stats, PipelineFrame& frame);
+
+    /** Pushes a frame in `queue`, waiting if it is full.
+     */
+    static void push(SpscQueue<PipelineFrame>& queue, PipelineFrame& frame);
+
+    static void wait(size_t& nb_attempts);
+
+    void account(StageStats& stats, Clock::time_point start);
+
+    HeadPoseEstimation detector, landmarker, poser;
+
+    Source source;
+    Sink sink;
+
+    SpscQueue<PipelineFrame> detected, fitted;
+    std::atomic<bool> detection_done, landmarks_done;
+
+    Clock::time_point start_time;
+    std::array<StageStats, 3> stage_stats;
+
+    std::thread detection_thread, landmarks_thread, pose_thread;
+};
+
+#endif // __PIPELINE_EXECUTOR
@@ -0,0 +1,51 @@
+#ifndef __REDUCED_DECODING
+#define __REDUCED_DECODING
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#ifdef OPENCV3
+#include <opencv2/imgcodecs.hpp>
+#else
+#include <opencv2/highgui/highgui.hpp>
+#endif
+
+/** Decodes a compressed colour image (JPEG, PNG, ...) `factor` times smaller
+ * than its full resolution (factor: 1, 2, 4 or 8).
+ *
+ * With OpenCV 3, JPEG images are downscaled in the DCT domain while they are
+ * decoded, which is much cheaper than decoding them at full resolution. The
+ * result is meant to be passed to HeadPoseEstimation::update(reduced_image,
+ * 1. / factor, ...) for face detection.
+ */
+inline cv::Mat decodeReduced(const std::vector<uchar>& data, int factor)
+{
+#ifdef OPENCV3
+    switch (factor) {
+        case 2: return cv::imdecode(data, cv::IMREAD_REDUCED_COLOR_2);
+        case 4: return cv::imdecode(data, cv::IMREAD_REDUCED_COLOR_4);
+        case 8: return cv::imdecode(data, cv::IMREAD_REDUCED_COLOR_8);
+        default: return cv::imdecode(data, cv::IMREAD_COLOR);
+    }
+#else
+    cv::Mat image = cv::imdecode(data, CV_LOAD_IMAGE_COLOR);
+    if (factor > 1 && !image.empty()) {
+        cv::resize(image, image, cv::Size(0, 0), 1. / factor, 1. / factor, cv::INTER_AREA);
+    }
+    return image;
+#endif
+}
+
+/** Decodes a compressed colour image at full resolution.
+ */
+inline cv::Mat decodeFull(const std::vector<uchar>& data)
+{
+#ifdef OPENCV3
+    return cv::imdecode(data, cv::IMREAD_COLOR);
+#else
+    return cv::imdecode(data, CV_LOAD_IMAGE_COLOR);
+#endif
+}
+
+#endif // __REDUCED_DECODING
@@ -0,0 +1,303 @@
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "result_cache.hpp"
+
+using namespace std;
+
+static const char CACHE_MAGIC[8] = {'G', 'A', 'Z', 'R', 'C', 'A', 'C', 'H'};
+static const uint32_t CACHE_VERSION = 1;
+
+// magic, version, reserved, fingerprint
+static const size_t HEADER_SIZE = 8 + 4 + 4 + 8;
+// image hash, image size, number of faces
+static const size_t ENTRY_HEADER_SIZE = 8 + 8 + 4;
+// bounding box (4 x int32), 68 landmarks (136 x int16), pose (first 3 rows: 12 x double)
+static const size_t NB_LANDMARKS = 68;
+static const size_t FACE_SIZE = 4 * 4 + 2 * NB_LANDMARKS * 2 + 12 * 8;
+
+uint64_t contentHash(const void* data, size_t size, uint64_t hash)
+{
+    const auto bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL; // FNV prime
+    }
+    return hash;
+}
+
+bool fileHash(const string& filename, uint64_t& hash)
+{
+    ifstream file(filename, ios::binary);
+    if (!file) return false;
+
+    hash = FNV_OFFSET_BASIS;
+    vector<char> buffer(1 << 20);
+    while (file) {
+        file.read(buffer.data(), buffer.size());
+        hash = contentHash(buffer.data(), file.gcount(), hash);
+    }
+    return true;
+}
+
+/** Appends the raw bytes of a value to a buffer.
+ */
+template<typename T>
+static inline void put(vector<char>& buffer, const T& value)
+{
+    const auto bytes = reinterpret_cast<const char*>(&value);
+    buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+}
+
+/** Reads a value from a buffer, and advances the read pointer.
+ */
+template<typename T>
+static inline T get(const char*& data)
+{
+    T value;
+    memcpy(&value, data, sizeof(T));
+    data += sizeof(T);
+    return value;
+}
+
+static bool readAt(int fd, void* data, size_t size, uint64_t offset)
+{
+    auto bytes = static_cast<char*>(data);
+    while (size > 0) {
+        auto n = pread(fd, bytes, size, offset);
+        if (n <= 0) return false;
+        bytes += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+static bool writeAt(int fd, const void* data, size_t size, uint64_t offset)
+{
+    auto bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        auto n = pwrite(fd, bytes, size, offset);
+        if (n <= 0) return false;
+        bytes += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+ResultCache::ResultCache(const string& directory, uint64_t fingerprint) :
+    hits(0),
+    misses(0),
+    fd(-1),
+    writable(true)
+{
+    mkdir(directory.c_str(), 0755); // fails if it already exists: fine
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.cache", (unsigned long long) fingerprint);
+
+    fd = open((directory + "/" + name).c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return;
+
+    // other processes might be using the same cache file
+    flock(fd, LOCK_EX);
+
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0;
+    if (ok && st.st_size > 0) {
+        ok = loadIndex(fingerprint);
+    }
+    else if (ok) {
+        vector<char> header(CACHE_MAGIC, CACHE_MAGIC + sizeof(CACHE_MAGIC));
+        put(header, CACHE_VERSION);
+        put(header, uint32_t(0));
+        put(header, fingerprint);
+
+        ok = writeAt(fd, header.data(), header.size(), 0);
+    }
+
+    flock(fd, LOCK_UN);
+
+    if (!ok) {
+        close(fd);
+        fd = -1;
+    }
+}
+
+ResultCache::~ResultCache()
+{
+    if (fd >= 0) close(fd);
+}
+
+bool ResultCache::loadIndex(uint64_t fingerprint)
+{
+    char header[HEADER_SIZE];
+    if (!readAt(fd, header, HEADER_SIZE, 0)) return false;
+
+    const char* data = header + sizeof(CACHE_MAGIC);
+    if (memcmp(header, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+        get<uint32_t>(data) != CACHE_VERSION) return false;
+    get<uint32_t>(data); // reserved
+    if (get<uint64_t>(data) != fingerprint) return false;
+
+    struct stat st;
+    fstat(fd, &st);
+    const uint64_t length = st.st_size;
+
+    uint64_t offset = HEADER_SIZE;
+    char entry_header[ENTRY_HEADER_SIZE];
+
+    while (offset + ENTRY_HEADER_SIZE <= length &&
+           readAt(fd, entry_header, ENTRY_HEADER_SIZE, offset)) {
+
+        const char* data = entry_header;
+        Key key;
+        key.hash = get<uint64_t>(data);
+        key.size = get<uint64_t>(data);
+        const auto nb_faces = get<uint32_t>(data);
+
+        const uint64_t entry_size = ENTRY_HEADER_SIZE + nb_faces * FACE_SIZE;
+        if (offset + entry_size > length) break;
+
+        index[key] = offset;
+        offset += entry_size;
+    }
+
+    // an interrupted run might have left an incomplete entry
+    return offset == length || ftruncate(fd, offset) == 0;
+}
+
+bool ResultCache::lookup(const vector<uchar>& content, CachedResult& result)
+{
+    Key key;
+    key.hash = contentHash(content.data(), content.size());
+    key.size = content.size();
+
+    uint64_t offset;
+    {
+        lock_guard<mutex> lock(index_mutex);
+        auto entry = index.find(key);
+        if (entry == index.end()) {
+            misses++;
+            return false;
+        }
+        offset = entry->second;
+    }
+
+    char entry_header[ENTRY_HEADER_SIZE];
+    if (!readAt(fd, entry_header, ENTRY_HEADER_SIZE, offset)) return false;
+    const char* data = entry_header + 16;
+    const auto nb_faces = get<uint32_t>(data);
+
+    vector<char> faces(nb_faces * FACE_SIZE);
+    if (!readAt(fd, faces.data(), faces.size(), offset + ENTRY_HEADER_SIZE)) return false;
+
+    result.faces.clear();
+    result.features.clear();
+    result.poses.clear();
+
+    data = faces.data();
+    for (size_t i = 0; i < nb_faces; ++i) {
+        cv::Rect rect;
+        rect.x = get<int32_t>(data);
+        rect.y = get<int32_t>(data);
+        rect.width = get<int32_t>(data);
+        rect.height = get<int32_t>(data);
+        result.faces.push_back(rect);
+
+        vector<cv::Point> features;
+        for (size_t j = 0; j < NB_LANDMARKS; ++j) {
+            int x = get<int16_t>(data);
+            int y = get<int16_t>(data);
+            features.push_back(cv::Point(x, y));
+        }
+        result.features.push_back(features);
+
+        head_pose pose = head_pose::eye();
+        for (size_t row = 0; row < 3; ++row) {
+            for (size_t col = 0; col < 4; ++col) {
+                pose(row, col) = get<double>(data);
+            }
+        }
+        result.poses.push_back(pose);
+    }
+
+    lock_guard<mutex> lock(index_mutex);
+    hits++;
+    return true;
+}
+
+void ResultCache::insert(const vector<uchar>& content, const CachedResult& result)
+{
+    if (fd < 0) return;
+
+    Key key;
+    key.hash = contentHash(content.data(), content.size());
+    key.size = content.size();
+
+    const uint32_t nb_faces = result.poses.size();
+
+    vector<char> entry;
+    entry.reserve(ENTRY_HEADER_SIZE + nb_faces * FACE_SIZE);
+    put(entry, key.hash);
+    put(entry, key.size);
+    put(entry, nb_faces);
+
+    for (size_t i = 0; i < nb_faces; ++i) {
+        const auto rect = i < result.faces.size() ? result.faces[i] : cv::Rect();
+        put(entry, int32_t(rect.x));
+        put(entry, int32_t(rect.y));
+        put(entry, int32_t(rect.width));
+        put(entry, int32_t(rect.height));
+
+        for (size_t j = 0; j < NB_LANDMARKS; ++j) {
+            const bool known = i < result.features.size() && j < result.features[i].size();
+            put(entry, int16_t(known ? result.features[i][j].x : 0));
+            put(entry, int16_t(known ? result.features[i][j].y : 0));
+        }
+
+        for (size_t row = 0; row < 3; ++row) {
+            for (size_t col = 0; col < 4; ++col) {
+                put(entry, double(result.poses[i](row, col)));
+            }
+        }
+    }
+
+    lock_guard<mutex> lock(index_mutex);
+    if (index.count(key)) return; // already inserted by another thread
+    if (!writable) return;
+
+    // other processes might append to the file as well (their entries are
+    // only seen when the cache is opened again)
+    flock(fd, LOCK_EX);
+
+    const auto offset = lseek(fd, 0, SEEK_END);
+    if (offset >= 0) {
+        if (writeAt(fd, entry.data(), entry.size(), offset)) {
+            index[key] = offset;
+        }
+        else {
+            // do not leave a partial entry behind, other entries might follow
+            if (ftruncate(fd, offset) != 0) {
+                // the partial entry is then dropped when the cache is opened
+                // again (see loadIndex()), as long as nothing follows it
+                writable = false;
+            }
+        }
+    }
+
+    flock(fd, LOCK_UN);
+}
+
+size_t ResultCache::size()
+{
+    lock_guard<mutex> lock(index_mutex);
+    return index.size();
+}
@@ -0,0 +1,98 @@
+#ifndef __RESULT_CACHE
+#define __RESULT_CACHE
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+
+#include "head_pose_estimation.hpp"
+
+/** What is cached for each image.
+ */
+struct CachedResult {
+    std::vector<cv::Rect> faces;
+    std::vector<std::vector<cv::Point>> features;
+    std::vector<head_pose> poses;
+};
+
+const static uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
+
+/** 64 bits FNV-1a hash of a buffer. Pass the previous hash as `hash` to hash
+ * several buffers in a row.
+ */
+uint64_t contentHash(const void* data, size_t size, uint64_t hash = FNV_OFFSET_BASIS);
+
+/** Hashes the content of a file (typically, the face model). Returns false
+ * if the file can not be read.
+ */
+bool fileHash(const std::string& filename, uint64_t& hash);
+
+/** On-disk cache of head pose results, keyed by the content of the images.
+ *
+ * The results depend on the model and the parameters used to compute them:
+ * they are summarised by a `fingerprint` (eg, the hash of the model file and
+ * of the parameters, see contentHash()). Each fingerprint has its own cache
+ * file in the cache directory, so changing the parameters never serves stale
+ * results.
+ *
+ * The cache file is append-only. Its index (image hash -> offset) is rebuilt
+ * in memory when the cache is opened; the results themselves are only read on
+ * lookup. lookup() and insert() are thread-safe, and several processes can
+ * share the same cache file (the file is locked while being written).
+ */
+class ResultCache {
+
+public:
+
+    ResultCache(const std::string& directory, uint64_t fingerprint);
+
+    ~ResultCache();
+
+    ResultCache(const ResultCache&) = delete;
+    ResultCache& operator=(const ResultCache&) = delete;
+
+    bool isOpen() const {return fd >= 0;}
+
+    /** Looks up the results of the image whose (encoded) content is given.
+     * Returns false if it is not in the cache.
+     */
+    bool lookup(const std::vector<uchar>& content, CachedResult& result);
+
+    /** Adds the results of an image to the cache.
+     */
+    void insert(const std::vector<uchar>& content, const CachedResult& result);
+
+    size_t size();
+
+    size_t hits, misses;
+
+private:
+
+    struct Key {
+        uint64_t hash;
+        uint64_t size; // in bytes: makes collisions even less likely
+        bool operator==(const Key& other) const {return hash == other.hash && size == other.size;}
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const {return key.hash;}
+    };
+
+    /** Reads the index of an existing cache file, and truncates any
+     * incomplete entry at its end. Returns false if the file is not valid.
+     */
+    bool loadIndex(uint64_t fingerprint);
+
+    int fd;
+
+    // false once a partial entry could not be removed: any entry appended
+    // after it would be lost (guarded by index_mutex)
+    bool writable;
+
+    std::mutex index_mutex;
+    std::unordered_map<Key, uint64_t, KeyHash> index; // offset of each entry
+};
+
+#endif // __RESULT_CACHE
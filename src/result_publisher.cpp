@@ -0,0 +1,185 @@
+#include <cstring>
+#include <atomic>
+#include <algorithm>
+#include <new>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "result_publisher.hpp"
+
+using namespace std;
+
+static const char PUBLISHER_MAGIC[8] = {'G', 'A', 'Z', 'R', 'P', 'U', 'B', 'L'};
+static const uint32_t PUBLISHER_VERSION = 1;
+
+/* The sequence is odd while the results are being written. A reader copies
+ * the results between two reads of the sequence: the copy is consistent if
+ * the sequence was even and did not change.
+ */
+struct PublishedSegment {
+    char magic[8];
+    uint32_t version;
+    uint32_t max_faces;
+    alignas(64) std::atomic<uint64_t> sequence;
+    uint64_t frame_idx;
+    double timestamp;
+    uint32_t nb_faces;
+    ResultRecord faces[1]; // actually max_faces
+};
+
+static size_t segmentSize(size_t max_faces)
+{
+    return sizeof(PublishedSegment) + (max_faces - 1) * sizeof(ResultRecord);
+}
+
+ResultPublisher::ResultPublisher(const string& name, size_t max_faces) :
+    name(name),
+    segment(nullptr),
+    segment_size(segmentSize(max<size_t>(max_faces, 1)))
+{
+    shm_unlink(name.c_str()); // left by a previous publisher
+
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) return;
+
+    if (ftruncate(fd, segment_size) != 0) {
+        ::close(fd);
+        shm_unlink(name.c_str());
+        return;
+    }
+
+    void* data = mmap(nullptr, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        return;
+    }
+
+    auto new_segment = new (data) PublishedSegment;
+    new_segment->version = PUBLISHER_VERSION;
+    new_segment->max_faces = max<size_t>(max_faces, 1);
+    new_segment->sequence = 0;
+    new_segment->frame_idx = 0;
+    new_segment->timestamp = 0;
+    new_segment->nb_faces = 0;
+
+    // the magic last: readers ignore the segment until then
+    atomic_thread_fence(memory_order_release);
+    memcpy(new_segment->magic, PUBLISHER_MAGIC, sizeof(PUBLISHER_MAGIC));
+
+    segment = new_segment;
+}
+
+ResultPublisher::~ResultPublisher()
+{
+    if (!segment) return;
+    munmap(segment, segment_size);
+    shm_unlink(name.c_str());
+}
+
+void ResultPublisher::publish(uint64_t frame_idx,
+                              double timestamp,
+                              const vector<head_pose>& poses,
+                              const vector<uint32_t>& track_ids)
+{
+    if (!segment) return;
+
+    // compute the records first, to keep the critical section short
+    const size_t nb_faces = min<size_t>(poses.size(), segment->max_faces);
+    vector<ResultRecord> records;
+    for (size_t i = 0; i < nb_faces; ++i) {
+        records.push_back(resultRecord(frame_idx, timestamp, i < track_ids.size() ? track_ids[i] : i, poses[i]));
+    }
+
+    const auto sequence = segment->sequence.load(memory_order_relaxed);
+    segment->sequence.store(sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    segment->frame_idx = frame_idx;
+    segment->timestamp = timestamp;
+    segment->nb_faces = nb_faces;
+    if (nb_faces > 0) memcpy(segment->faces, records.data(), nb_faces * sizeof(ResultRecord));
+
+    segment->sequence.store(sequence + 2, memory_order_release);
+}
+
+ResultSubscriber::~ResultSubscriber()
+{
+    close();
+}
+
+bool ResultSubscriber::open(const string& name)
+{
+    close();
+
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(PublishedSegment)) {
+        ::close(fd);
+        return false;
+    }
+
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) return false;
+
+    auto published = static_cast<PublishedSegment*>(data);
+    if (memcmp(published->magic, PUBLISHER_MAGIC, sizeof(PUBLISHER_MAGIC)) != 0 ||
+        published->version != PUBLISHER_VERSION ||
+        static_cast<size_t>(st.st_size) < segmentSize(published->max_faces)) {
+        munmap(data, st.st_size);
+        return false;
+    }
+    atomic_thread_fence(memory_order_acquire);
+
+    segment = published;
+    segment_size = st.st_size;
+    return true;
+}
+
+void ResultSubscriber::close()
+{
+    if (segment) munmap(segment, segment_size);
+    segment = nullptr;
+    segment_size = 0;
+}
+
+uint64_t ResultSubscriber::sequence() const
+{
+    if (!segment) return 0;
+    return segment->sequence.load(memory_order_acquire) / 2;
+}
+
+bool ResultSubscriber::tryRead(PublishedResults& results) const
+{
+    if (!segment) return false;
+
+    const auto before = segment->sequence.load(memory_order_acquire);
+    if (before % 2 == 1) return false; // being written
+
+    results.frame_idx = segment->frame_idx;
+    results.timestamp = segment->timestamp;
+    const size_t nb_faces = min<size_t>(segment->nb_faces, segment->max_faces);
+    results.faces.resize(nb_faces);
+    if (nb_faces > 0) memcpy(results.faces.data(), segment->faces, nb_faces * sizeof(ResultRecord));
+
+    atomic_thread_fence(memory_order_acquire);
+    const auto after = segment->sequence.load(memory_order_relaxed);
+    if (after != before) return false; // overwritten while copying
+
+    results.sequence = before / 2;
+    return true;
+}
+
+bool ResultSubscriber::read(PublishedResults& results, size_t max_attempts) const
+{
+    for (size_t i = 0; i < max_attempts; ++i) {
+        if (tryRead(results)) return true;
+    }
+    return false;
+}
@@ -0,0 +1,106 @@
+#ifndef __RESULT_PUBLISHER
+#define __RESULT_PUBLISHER
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "head_pose_estimation.hpp"
+#include "result_writer.hpp" // ResultRecord
+
+/** Latest results of an estimator, published in a POSIX shared memory
+ * segment for the other processes of the host (gaze controller, logger,
+ * UI...), without any serialisation.
+ *
+ * The segment holds the results of the last frame only, guarded by a
+ * seqlock: the publisher never waits for the readers, and any number of
+ * readers can poll it without ever blocking the publisher nor each other.
+ * A reader only has to retry when it raced with a publication.
+ */
+
+/** Results of one frame, as read by ResultSubscriber.
+ */
+struct PublishedResults {
+    uint64_t sequence;  // number of frames published so far (to detect new results)
+    uint64_t frame_idx;
+    double timestamp;   // in seconds
+    std::vector<ResultRecord> faces;
+};
+
+struct PublishedSegment;
+
+class ResultPublisher {
+
+public:
+
+    /** Creates the segment `name` (eg "/gazr-results"), with room for
+     * `max_faces` faces per frame (the others are not published).
+     */
+    ResultPublisher(const std::string& name, size_t max_faces = 32);
+
+    /** Removes the segment: the readers keep their mapping, but no new
+     * results are published.
+     */
+    ~ResultPublisher();
+
+    ResultPublisher(const ResultPublisher&) = delete;
+    ResultPublisher& operator=(const ResultPublisher&) = delete;
+
+    bool isOpen() const {return segment != nullptr;}
+
+    /** Publishes the faces detected in one frame. `track_ids` gives the ID
+     * of each face (by default, its index in `poses`).
+     */
+    void publish(uint64_t frame_idx,
+                 double timestamp,
+                 const std::vector<head_pose>& poses,
+                 const std::vector<uint32_t>& track_ids = std::vector<uint32_t>());
+
+private:
+
+    std::string name;
+    PublishedSegment* segment;
+    size_t segment_size;
+};
+
+class ResultSubscriber {
+
+public:
+
+    ResultSubscriber() : segment(nullptr), segment_size(0) {}
+
+    ~ResultSubscriber();
+
+    ResultSubscriber(const ResultSubscriber&) = delete;
+    ResultSubscriber& operator=(const ResultSubscriber&) = delete;
+
+    /** Maps the segment published under `name`. Returns false if there is
+     * no such publisher.
+     */
+    bool open(const std::string& name);
+
+    void close();
+
+    bool isOpen() const {return segment != nullptr;}
+
+    /** Number of frames published so far. Cheap: poll it to know when
+     * there are new results.
+     */
+    uint64_t sequence() const;
+
+    /** Copies the latest results. Wait-free: returns false if the results
+     * were being published at the same time (try again).
+     */
+    bool tryRead(PublishedResults& results) const;
+
+    /** Calls tryRead() until it succeeds, at most `max_attempts` times.
+     */
+    bool read(PublishedResults& results, size_t max_attempts = 100) const;
+
+private:
+
+    PublishedSegment* segment;
+    size_t segment_size;
+};
+
+#endif // __RESULT_PUBLISHER
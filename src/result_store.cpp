@@ -0,0 +1,317 @@
+#include <fstream>
+#include <algorithm>
+#include <limits>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "result_store.hpp"
+#include "result_writer.hpp" // headQuaternion
+
+using namespace std;
+
+static const size_t LANDMARKS_ROW_SIZE = 2 * RESULT_STORE_NB_LANDMARKS * sizeof(int16_t);
+
+static const size_t NB_COLUMNS = 6;
+static const char* COLUMN_NAMES[NB_COLUMNS] = {"frame_idx.u64", "timestamp.f64", "track_id.u32",
+                                               "translation.3f32", "rotation.4f32", "landmarks.136i16"};
+static const size_t ROW_SIZES[NB_COLUMNS] = {sizeof(uint64_t), sizeof(double), sizeof(uint32_t),
+                                             3 * sizeof(float), 4 * sizeof(float), LANDMARKS_ROW_SIZE};
+
+/** Size of a file, in bytes (0 if it does not exist).
+ */
+static uint64_t fileSize(const string& path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return 0;
+    return st.st_size;
+}
+
+/** Reads the `meta` file of a store. Returns false if it does not exist or
+ * is not valid.
+ */
+static bool readMeta(const string& directory, bool& with_landmarks)
+{
+    ifstream meta(directory + "/meta");
+    string magic;
+    uint32_t version;
+    string key;
+    size_t nb_landmarks;
+
+    if (!(meta >> magic >> version >> key >> nb_landmarks)) return false;
+    if (magic != "gazr-result-store" || version != RESULT_STORE_VERSION || key != "landmarks") return false;
+
+    with_landmarks = nb_landmarks > 0;
+    return true;
+}
+
+ResultStoreWriter::ResultStoreWriter(const string& directory, bool with_landmarks, size_t buffer_size, bool append) :
+    directory(directory),
+    with_landmarks(with_landmarks),
+    buffer_size(buffer_size),
+    is_open(false),
+    nb_rows(0),
+    nb_buffered_rows(0)
+{
+    Column* columns[] = {&frame_idx_column, &timestamp_column, &track_id_column,
+                         &translation_column, &rotation_column, &landmarks_column};
+    for (size_t i = 0; i < NB_COLUMNS; ++i) {
+        columns[i]->name = COLUMN_NAMES[i];
+        columns[i]->row_size = ROW_SIZES[i];
+        columns[i]->file = nullptr;
+    }
+
+    if (!append) remove(directory); // fails if there is no store: fine
+
+    mkdir(directory.c_str(), 0755); // fails if it already exists: fine
+
+    bool existing_landmarks;
+    if (readMeta(directory, existing_landmarks)) {
+        // appending to an existing store: the columns must match
+        if (existing_landmarks != with_landmarks) return;
+    }
+    else {
+        ofstream meta(directory + "/meta");
+        meta << "gazr-result-store " << RESULT_STORE_VERSION << "\n"
+             << "landmarks " << (with_landmarks ? RESULT_STORE_NB_LANDMARKS : 0) << "\n";
+        if (!meta) return;
+    }
+
+    // rows complete in every column: an interrupted run might have left
+    // partial ones, that would shift the rows appended now
+    nb_rows = numeric_limits<uint64_t>::max();
+    for (auto column : columns) {
+        if (column == &landmarks_column && !with_landmarks) continue;
+        nb_rows = min(nb_rows, fileSize(directory + "/" + column->name) / column->row_size);
+    }
+    if (!truncate(directory, nb_rows)) return;
+
+    for (auto column : columns) {
+        if (column == &landmarks_column && !with_landmarks) continue;
+
+        column->file = fopen((directory + "/" + column->name).c_str(), "ab");
+        if (!column->file) return;
+        column->buffer.reserve(buffer_size);
+    }
+
+    is_open = true;
+}
+
+ResultStoreWriter::~ResultStoreWriter()
+{
+    flush();
+
+    Column* columns[] = {&frame_idx_column, &timestamp_column, &track_id_column,
+                         &translation_column, &rotation_column, &landmarks_column};
+    for (auto column : columns) {
+        if (column->file) fclose(column->file);
+    }
+}
+
+void ResultStoreWriter::write(Column& column, const void* data, size_t size)
+{
+    column.buffer.append(static_cast<const char*>(data), size);
+}
+
+void ResultStoreWriter::append(uint64_t frame_idx,
+                               double timestamp,
+                               const vector<head_pose>& poses,
+                               const vector<uint32_t>& track_ids,
+                               const vector<vector<cv::Point>>& features)
+{
+    if (!is_open) return;
+
+    for (size_t i = 0; i < poses.size(); ++i) {
+        const auto& pose = poses[i];
+
+        const uint32_t track_id = i < track_ids.size() ? track_ids[i] : i;
+
+        const float translation[3] = {(float) pose(0,3), (float) pose(1,3), (float) pose(2,3)};
+
+        double q[4];
+        headQuaternion(pose, q);
+        const float rotation[4] = {(float) q[0], (float) q[1], (float) q[2], (float) q[3]};
+
+        write(frame_idx_column, &frame_idx, sizeof(frame_idx));
+        write(timestamp_column, &timestamp, sizeof(timestamp));
+        write(track_id_column, &track_id, sizeof(track_id));
+        write(translation_column, translation, sizeof(translation));
+        write(rotation_column, rotation, sizeof(rotation));
+
+        if (with_landmarks) {
+            int16_t landmarks[2 * RESULT_STORE_NB_LANDMARKS] = {0};
+            if (i < features.size()) {
+                for (size_t j = 0; j < min(features[i].size(), RESULT_STORE_NB_LANDMARKS); ++j) {
+                    landmarks[2 * j] = features[i][j].x;
+                    landmarks[2 * j + 1] = features[i][j].y;
+                }
+            }
+            write(landmarks_column, landmarks, sizeof(landmarks));
+        }
+    }
+    nb_buffered_rows += poses.size();
+
+    const auto& largest_column = with_landmarks ? landmarks_column : rotation_column;
+    if (largest_column.buffer.size() >= buffer_size) flush();
+}
+
+void ResultStoreWriter::flush()
+{
+    Column* columns[] = {&frame_idx_column, &timestamp_column, &track_id_column,
+                         &translation_column, &rotation_column, &landmarks_column};
+    for (auto column : columns) {
+        if (!column->file || column->buffer.empty()) continue;
+        fwrite(column->buffer.data(), 1, column->buffer.size(), column->file);
+        fflush(column->file);
+        column->buffer.clear();
+    }
+
+    nb_rows += nb_buffered_rows;
+    nb_buffered_rows = 0;
+}
+
+bool ResultStoreWriter::merge(const string& other_directory)
+{
+    bool other_landmarks;
+    if (!is_open || !readMeta(other_directory, other_landmarks) || other_landmarks != with_landmarks) return false;
+
+    Column* columns[] = {&frame_idx_column, &timestamp_column, &track_id_column,
+                         &translation_column, &rotation_column, &landmarks_column};
+
+    uint64_t other_rows = numeric_limits<uint64_t>::max();
+    for (auto column : columns) {
+        if (!column->file) continue;
+        other_rows = min(other_rows, fileSize(other_directory + "/" + column->name) / column->row_size);
+    }
+
+    flush();
+
+    vector<char> buffer(buffer_size);
+    for (auto column : columns) {
+        if (!column->file) continue;
+
+        FILE* other = fopen((other_directory + "/" + column->name).c_str(), "rb");
+        if (!other) return false;
+
+        uint64_t remaining = other_rows * column->row_size;
+        while (remaining > 0) {
+            const auto size = fread(buffer.data(), 1, min<uint64_t>(buffer.size(), remaining), other);
+            if (size == 0) break;
+            fwrite(buffer.data(), 1, size, column->file);
+            remaining -= size;
+        }
+        fclose(other);
+        fflush(column->file);
+
+        if (remaining > 0) return false;
+    }
+
+    nb_rows += other_rows;
+    return true;
+}
+
+bool ResultStoreWriter::truncate(const string& directory, uint64_t nb_rows)
+{
+    bool with_landmarks;
+    if (!readMeta(directory, with_landmarks)) return false;
+
+    for (size_t i = 0; i < NB_COLUMNS; ++i) {
+        if (i == NB_COLUMNS - 1 && !with_landmarks) continue;
+
+        const auto path = directory + "/" + COLUMN_NAMES[i];
+        const auto size = fileSize(path);
+        if (size < nb_rows * ROW_SIZES[i]) return false;
+        if (size > nb_rows * ROW_SIZES[i] && ::truncate(path.c_str(), nb_rows * ROW_SIZES[i]) != 0) return false;
+    }
+    return true;
+}
+
+bool ResultStoreWriter::remove(const string& directory)
+{
+    bool with_landmarks;
+    if (!readMeta(directory, with_landmarks)) return false;
+
+    for (auto name : COLUMN_NAMES) {
+        ::remove((directory + "/" + name).c_str()); // the landmarks might not be there
+    }
+    return ::remove((directory + "/meta").c_str()) == 0 && rmdir(directory.c_str()) == 0;
+}
+
+ResultStoreReader::~ResultStoreReader()
+{
+    close();
+}
+
+bool ResultStoreReader::map(const string& path, MappedColumn& column)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    column.length = st.st_size;
+    column.data = nullptr;
+    if (column.length > 0) {
+        void* data = mmap(nullptr, column.length, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            ::close(fd);
+            column.length = 0;
+            return false;
+        }
+        column.data = data;
+    }
+
+    ::close(fd); // the mapping stays valid
+    return true;
+}
+
+void ResultStoreReader::unmap(MappedColumn& column)
+{
+    if (column.data) munmap(const_cast<void*>(column.data), column.length);
+    column.data = nullptr;
+    column.length = 0;
+}
+
+bool ResultStoreReader::open(const string& directory)
+{
+    close();
+
+    if (!readMeta(directory, has_landmarks)) return false;
+
+    if (!map(directory + "/frame_idx.u64", frame_idx_column) ||
+        !map(directory + "/timestamp.f64", timestamp_column) ||
+        !map(directory + "/track_id.u32", track_id_column) ||
+        !map(directory + "/translation.3f32", translation_column) ||
+        !map(directory + "/rotation.4f32", rotation_column) ||
+        (has_landmarks && !map(directory + "/landmarks.136i16", landmarks_column))) {
+        close();
+        return false;
+    }
+
+    // only the rows complete in every column (the last write might have been interrupted)
+    nb_rows = min({frame_idx_column.length / sizeof(uint64_t),
+                   timestamp_column.length / sizeof(double),
+                   track_id_column.length / sizeof(uint32_t),
+                   translation_column.length / (3 * sizeof(float)),
+                   rotation_column.length / (4 * sizeof(float))});
+    if (has_landmarks) nb_rows = min(nb_rows, landmarks_column.length / LANDMARKS_ROW_SIZE);
+
+    return true;
+}
+
+void ResultStoreReader::close()
+{
+    unmap(frame_idx_column);
+    unmap(timestamp_column);
+    unmap(track_id_column);
+    unmap(translation_column);
+    unmap(rotation_column);
+    unmap(landmarks_column);
+    nb_rows = 0;
+}
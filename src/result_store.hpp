@@ -0,0 +1,155 @@
+#ifndef __RESULT_STORE
+#define __RESULT_STORE
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+
+#include "head_pose_estimation.hpp"
+
+/** Append-only columnar store of head pose results, for dataset-scale runs.
+ *
+ * A store is a directory, with one raw little-endian array per column (one
+ * row per detected face):
+ *
+ *     frame_idx.u64        uint64_t
+ *     timestamp.f64        double (seconds)
+ *     track_id.u32         uint32_t
+ *     translation.3f32     3 x float (head position in the camera frame, meters)
+ *     rotation.4f32        4 x float (head orientation quaternion x, y, z, w)
+ *     landmarks.136i16     136 x int16_t (x, y of the 68 facial features, pixels; optional)
+ *
+ * The files have no header, so that they can be memory-mapped as is (by
+ * ResultStoreReader, or eg numpy.memmap). A `meta` text file describes the
+ * store. If a run is interrupted, the columns might have different lengths:
+ * only the rows present in every column are valid (the others are dropped
+ * when the store is opened again for writing).
+ */
+
+const static uint32_t RESULT_STORE_VERSION = 1;
+const static size_t RESULT_STORE_NB_LANDMARKS = 68;
+
+class ResultStoreWriter {
+
+public:
+
+    /** Opens (and creates if needed) the store. If `append` is true,
+     * results are appended to the existing ones, if any, after dropping the
+     * incomplete rows. Otherwise, an existing store is replaced.
+     */
+    ResultStoreWriter(const std::string& directory, bool with_landmarks = false, size_t buffer_size = 1 << 20, bool append = true);
+
+    ~ResultStoreWriter();
+
+    ResultStoreWriter(const ResultStoreWriter&) = delete;
+    ResultStoreWriter& operator=(const ResultStoreWriter&) = delete;
+
+    bool isOpen() const {return is_open;}
+
+    /** Appends the faces detected in one frame. `track_ids` gives the ID of
+     * each face (by default, its index in `poses`), `features` their facial
+     * features (only stored if the store has landmarks).
+     */
+    void append(uint64_t frame_idx,
+                double timestamp,
+                const std::vector<head_pose>& poses,
+                const std::vector<uint32_t>& track_ids = std::vector<uint32_t>(),
+                const std::vector<std::vector<cv::Point>>& features = std::vector<std::vector<cv::Point>>());
+
+    void flush();
+
+    /** Number of rows written to the columns so far (including the rows
+     * already in the store when it was opened, but not the buffered ones).
+     */
+    uint64_t size() const {return nb_rows;}
+
+    /** Appends the (complete) rows of another store with the same columns,
+     * eg written by another process. Returns false if `directory` is not
+     * such a store.
+     */
+    bool merge(const std::string& directory);
+
+    /** Drops the rows of the store after the first `nb_rows`. Returns false
+     * if the directory is not a result store, or has less rows.
+     */
+    static bool truncate(const std::string& directory, uint64_t nb_rows);
+
+    /** Deletes a store. Returns false if the directory is not a result
+     * store, or could not be deleted.
+     */
+    static bool remove(const std::string& directory);
+
+private:
+
+    struct Column {
+        std::string name;
+        size_t row_size; // in bytes
+        FILE* file;
+        std::string buffer;
+    };
+
+    void write(Column& column, const void* data, size_t size);
+
+    std::string directory;
+    bool with_landmarks;
+    size_t buffer_size;
+    bool is_open;
+
+    uint64_t nb_rows;
+    uint64_t nb_buffered_rows;
+
+    Column frame_idx_column, timestamp_column, track_id_column,
+           translation_column, rotation_column, landmarks_column;
+};
+
+/** Read-only access to a store, through memory-mapped columns.
+ */
+class ResultStoreReader {
+
+public:
+
+    ResultStoreReader() : nb_rows(0), has_landmarks(false) {}
+
+    ~ResultStoreReader();
+
+    ResultStoreReader(const ResultStoreReader&) = delete;
+    ResultStoreReader& operator=(const ResultStoreReader&) = delete;
+
+    /** Maps the columns of the store. Returns false if the directory is not
+     * a result store.
+     */
+    bool open(const std::string& directory);
+
+    void close();
+
+    size_t size() const {return nb_rows;}
+
+    bool hasLandmarks() const {return has_landmarks;}
+
+    const uint64_t* frameIdx() const {return static_cast<const uint64_t*>(frame_idx_column.data);}
+    const double* timestamps() const {return static_cast<const double*>(timestamp_column.data);}
+    const uint32_t* trackIds() const {return static_cast<const uint32_t*>(track_id_column.data);}
+    const float* translations() const {return static_cast<const float*>(translation_column.data);} // 3 per row
+    const float* rotations() const {return static_cast<const float*>(rotation_column.data);}       // 4 per row
+    const int16_t* landmarks() const {return static_cast<const int16_t*>(landmarks_column.data);}  // 136 per row, or nullptr
+
+private:
+
+    struct MappedColumn {
+        MappedColumn() : data(nullptr), length(0) {}
+        const void* data;
+        size_t length; // in bytes
+    };
+
+    bool map(const std::string& path, MappedColumn& column);
+    void unmap(MappedColumn& column);
+
+    size_t nb_rows;
+    bool has_landmarks;
+
+    MappedColumn frame_idx_column, timestamp_column, track_id_column,
+                 translation_column, rotation_column, landmarks_column;
+};
+
+#endif // __RESULT_STORE
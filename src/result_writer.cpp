@@ -0,0 +1,316 @@
+#include <cmath>
+#include <cstdio>
+#include <cinttypes>
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "result_writer.hpp"
+
+using namespace std;
+
+void headOrientation(const head_pose& pose, double& yaw, double& pitch, double& roll)
+{
+    // rotation of the camera, seen from the head (transpose of the head rotation)
+    double m[3][3];
+    for (size_t i = 0; i < 3; ++i) {
+        for (size_t j = 0; j < 3; ++j) {
+            m[i][j] = pose(j, i);
+        }
+    }
+
+    // Euler angles (yaw around Z, pitch around Y, roll around X), computed as
+    // tf::Matrix3x3::getRPY does
+    double raw_yaw, raw_pitch, raw_roll;
+    if (fabs(m[2][0]) >= 1) { // gimbal lock
+        raw_yaw = 0;
+        if (m[2][0] < 0) {
+            raw_pitch = M_PI / 2;
+            raw_roll = atan2(m[0][1], m[0][2]);
+        }
+        else {
+            raw_pitch = -M_PI / 2;
+            raw_roll = atan2(-m[0][1], -m[0][2]);
+        }
+    }
+    else {
+        raw_pitch = -asin(m[2][0]);
+        const double c = cos(raw_pitch);
+        raw_roll = atan2(m[2][1] / c, m[2][2] / c);
+        raw_yaw = atan2(m[1][0] / c, m[0][0] / c);
+    }
+
+    // the X axis of the head points forward, the Z axis of the camera as well
+    raw_roll = raw_roll - M_PI / 2;
+    raw_yaw = raw_yaw + M_PI / 2;
+
+    roll = raw_pitch;
+    yaw = raw_yaw;
+    pitch = -raw_roll;
+}
+
+void headQuaternion(const head_pose& pose, double q[4])
+{
+    const double trace = pose(0,0) + pose(1,1) + pose(2,2);
+
+    if (trace > 0) {
+        const double s = sqrt(trace + 1.) * 2;
+        q[3] = s / 4;
+        q[0] = (pose(2,1) - pose(1,2)) / s;
+        q[1] = (pose(0,2) - pose(2,0)) / s;
+        q[2] = (pose(1,0) - pose(0,1)) / s;
+    }
+    else if (pose(0,0) > pose(1,1) && pose(0,0) > pose(2,2)) {
+        const double s = sqrt(1. + pose(0,0) - pose(1,1) - pose(2,2)) * 2;
+        q[3] = (pose(2,1) - pose(1,2)) / s;
+        q[0] = s / 4;
+        q[1] = (pose(0,1) + pose(1,0)) / s;
+        q[2] = (pose(0,2) + pose(2,0)) / s;
+    }
+    else if (pose(1,1) > pose(2,2)) {
+        const double s = sqrt(1. + pose(1,1) - pose(0,0) - pose(2,2)) * 2;
+        q[3] = (pose(0,2) - pose(2,0)) / s;
+        q[0] = (pose(0,1) + pose(1,0)) / s;
+        q[1] = s / 4;
+        q[2] = (pose(1,2) + pose(2,1)) / s;
+    }
+    else {
+        const double s = sqrt(1. + pose(2,2) - pose(0,0) - pose(1,1)) * 2;
+        q[3] = (pose(1,0) - pose(0,1)) / s;
+        q[0] = (pose(0,2) + pose(2,0)) / s;
+        q[1] = (pose(1,2) + pose(2,1)) / s;
+        q[2] = s / 4;
+    }
+}
+
+ResultRecord resultRecord(uint64_t frame_idx, double timestamp, uint32_t track_id, const head_pose& pose)
+{
+    ResultRecord record;
+    record.frame_idx = frame_idx;
+    record.timestamp = timestamp;
+    record.track_id = track_id;
+
+    for (size_t j = 0; j < 3; ++j) record.translation[j] = pose(j, 3);
+
+    double q[4];
+    headQuaternion(pose, q);
+    for (size_t j = 0; j < 4; ++j) record.rotation[j] = q[j];
+
+    return record;
+}
+
+ResultWriter::ResultWriter(ostream& out, Format format, size_t buffer_size) :
+    out(out),
+    format(format),
+    buffer_size(buffer_size),
+    written(0)
+{
+    writeHeader();
+}
+
+ResultWriter::ResultWriter(const string& filename, Format format, size_t buffer_size, bool append) :
+    out(filename.empty() || filename == "-" ? cout : file),
+    format(format),
+    buffer_size(buffer_size),
+    written(0)
+{
+    if (format == COLUMNAR || format == COLUMNAR_LANDMARKS) {
+        if (&out == &file) store.reset(new ResultStoreWriter(filename, format == COLUMNAR_LANDMARKS, 1 << 20, append));
+        return;
+    }
+
+    if (&out == &file) {
+        struct stat st;
+        if (append && stat(filename.c_str(), &st) == 0 && st.st_size > 0) {
+            // the header is already there
+            file.open(filename, ios::binary | ios::app);
+            written = st.st_size;
+            buffer.reserve(buffer_size);
+            return;
+        }
+        file.open(filename, ios::binary);
+    }
+    writeHeader();
+}
+
+void ResultWriter::writeHeader()
+{
+    buffer.reserve(buffer_size);
+
+    if (format == BINARY) {
+        const uint32_t header[2] = {RESULT_FILE_VERSION, sizeof(ResultRecord)};
+        buffer.append(RESULT_FILE_MAGIC, sizeof(RESULT_FILE_MAGIC));
+        buffer.append(reinterpret_cast<const char*>(header), sizeof(header));
+    }
+}
+
+ResultWriter::~ResultWriter()
+{
+    flush();
+}
+
+bool ResultWriter::parseFormat(const string& name, Format& format)
+{
+    if (name == "json" || name == "ndjson") format = NDJSON;
+    else if (name == "binary") format = BINARY;
+    else if (name == "columnar") format = COLUMNAR;
+    else if (name == "columnar-landmarks") format = COLUMNAR_LANDMARKS;
+    else return false;
+
+    return true;
+}
+
+void ResultWriter::write(uint64_t frame_idx,
+                         double timestamp,
+                         const vector<head_pose>& poses,
+                         const vector<uint32_t>& track_ids,
+                         const string& source,
+                         const vector<vector<cv::Point>>& features)
+{
+    if (store) {
+        store->append(frame_idx, timestamp, poses, track_ids, features);
+        return;
+    }
+
+    if (format == NDJSON) writeJson(frame_idx, timestamp, poses, track_ids, source);
+    else if (format == BINARY) writeBinary(frame_idx, timestamp, poses, track_ids);
+
+    if (buffer.size() >= buffer_size) flush();
+}
+
+void ResultWriter::flush()
+{
+    if (store) store->flush();
+
+    if (buffer.empty()) return;
+
+    out.write(buffer.data(), buffer.size());
+    out.flush();
+    written += buffer.size();
+    buffer.clear();
+}
+
+bool ResultWriter::merge(const string& filename)
+{
+    if (store) return store->merge(filename);
+
+    ifstream other(filename, ios::binary);
+    if (!other) return false;
+
+    if (format == BINARY) {
+        char header[sizeof(RESULT_FILE_MAGIC) + 2 * sizeof(uint32_t)];
+        if (!other.read(header, sizeof(header)) || memcmp(header, RESULT_FILE_MAGIC, sizeof(RESULT_FILE_MAGIC)) != 0) return false;
+    }
+
+    flush();
+
+    vector<char> chunk(max<size_t>(buffer_size, 4096));
+    while (other) {
+        other.read(chunk.data(), chunk.size());
+        out.write(chunk.data(), other.gcount());
+        written += other.gcount();
+    }
+    out.flush();
+
+    return other.eof() && out.good();
+}
+
+bool ResultWriter::remove(const string& filename, Format format)
+{
+    if (format == COLUMNAR || format == COLUMNAR_LANDMARKS) return ResultStoreWriter::remove(filename);
+    return ::remove(filename.c_str()) == 0;
+}
+
+bool ResultWriter::truncate(const string& filename, Format format, uint64_t offset)
+{
+    if (format == COLUMNAR || format == COLUMNAR_LANDMARKS) {
+        return ResultStoreWriter::truncate(filename, offset);
+    }
+
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0 || static_cast<uint64_t>(st.st_size) < offset) return false;
+    return static_cast<uint64_t>(st.st_size) == offset || ::truncate(filename.c_str(), offset) == 0;
+}
+
+/** Appends `"key":value` to a JSON object, or `"key":null` if the value is
+ * not finite (nan and inf are not valid JSON).
+ */
+static void appendJsonNumber(string& buffer, const char* key, double value, int precision)
+{
+    char tmp[64];
+    if (isfinite(value)) snprintf(tmp, sizeof(tmp), ",\"%s\":%.*f", key, precision, value);
+    else snprintf(tmp, sizeof(tmp), ",\"%s\":null", key);
+    buffer += tmp;
+}
+
+void ResultWriter::writeJson(uint64_t frame_idx,
+                             double timestamp,
+                             const vector<head_pose>& poses,
+                             const vector<uint32_t>& track_ids,
+                             const string& source)
+{
+    char tmp[256];
+
+    snprintf(tmp, sizeof(tmp), "{\"frame\":%" PRIu64, frame_idx);
+    buffer += tmp;
+    appendJsonNumber(buffer, "timestamp", timestamp, 3);
+
+    if (!source.empty()) {
+        buffer += ",\"source\":\"";
+        for (auto c : source) {
+            if (c == '"' || c == '\\') {
+                buffer += '\\';
+                buffer += c;
+            }
+            else if (static_cast<unsigned char>(c) < 0x20) {
+                snprintf(tmp, sizeof(tmp), "\\u%04x", c);
+                buffer += tmp;
+            }
+            else buffer += c;
+        }
+        buffer += '"';
+    }
+
+    buffer += ",\"faces\":[";
+    for (size_t i = 0; i < poses.size(); ++i) {
+        const auto& pose = poses[i];
+
+        double yaw, pitch, roll;
+        headOrientation(pose, yaw, pitch, roll);
+
+        // as gazr_estimate_head_direction always printed: the position of
+        // the camera in the frame of the head (translation of the inverse
+        // pose, -R^T t)
+        double position[3];
+        for (size_t row = 0; row < 3; ++row) {
+            position[row] = -(pose(0,row) * pose(0,3) + pose(1,row) * pose(1,3) + pose(2,row) * pose(2,3));
+        }
+
+        snprintf(tmp, sizeof(tmp), "%s{\"id\":%u",
+                 i > 0 ? "," : "",
+                 i < track_ids.size() ? track_ids[i] : static_cast<uint32_t>(i));
+        buffer += tmp;
+        appendJsonNumber(buffer, "yaw", yaw * 180 / M_PI, 1);
+        appendJsonNumber(buffer, "pitch", pitch * 180 / M_PI, 1);
+        appendJsonNumber(buffer, "roll", roll * 180 / M_PI, 1);
+        appendJsonNumber(buffer, "x", position[0], 4);
+        appendJsonNumber(buffer, "y", position[1], 4);
+        appendJsonNumber(buffer, "z", position[2], 4);
+        buffer += '}';
+    }
+    buffer += "]}\n";
+}
+
+void ResultWriter::writeBinary(uint64_t frame_idx,
+                               double timestamp,
+                               const vector<head_pose>& poses,
+                               const vector<uint32_t>& track_ids)
+{
+    for (size_t i = 0; i < poses.size(); ++i) {
+        const auto record = resultRecord(frame_idx, timestamp, i < track_ids.size() ? track_ids[i] : i, poses[i]);
+        buffer.append(reinterpret_cast<const char*>(&record), sizeof(record));
+    }
+}
@@ -0,0 +1,158 @@
+#ifndef __RESULT_WRITER
+#define __RESULT_WRITER
+
+#include <ostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <memory>
+
+#include "head_pose_estimation.hpp"
+#include "result_store.hpp"
+
+/** One face in one frame, as written by ResultWriter in binary mode.
+ *
+ * The record has a fixed size of 48 bytes, in the native (little-endian on
+ * all the platforms we support) byte order.
+ */
+struct ResultRecord {
+    uint64_t frame_idx;
+    double timestamp;     // in seconds
+    uint32_t track_id;
+    float translation[3]; // position of the head in the camera frame, in meters
+    float rotation[4];    // orientation of the head in the camera frame (quaternion x, y, z, w)
+};
+
+static_assert(sizeof(ResultRecord) == 48, "ResultRecord must be 48 bytes long");
+
+/** Magic string at the beginning of binary result files, followed by the
+ * format version and the size of the records (two uint32_t).
+ */
+const static char RESULT_FILE_MAGIC[8] = {'G', 'A', 'Z', 'R', 'P', 'O', 'S', 'E'};
+const static uint32_t RESULT_FILE_VERSION = 1;
+
+/** Yaw, pitch and roll of the head (in radians), as seen from the camera.
+ */
+void headOrientation(const head_pose& pose, double& yaw, double& pitch, double& roll);
+
+/** Quaternion (x, y, z, w) of the rotation part of the pose.
+ */
+void headQuaternion(const head_pose& pose, double quaternion[4]);
+
+/** The record of one face.
+ */
+ResultRecord resultRecord(uint64_t frame_idx, double timestamp, uint32_t track_id, const head_pose& pose);
+
+/** Buffered writer of head pose results.
+ *
+ * Two formats are supported:
+ *
+ *  - NDJSON: one JSON object per frame and per line:
+ *
+ *        {"frame":12,"timestamp":0.48,"faces":[{"id":0,"yaw":10.2,"pitch":-3.1,"roll":0.4,"x":0.0521,"y":-0.1023,"z":0.8733}]}
+ *
+ *    (angles in degrees; x, y, z: position of the camera in the frame of the
+ *    head, in meters, as gazr_estimate_head_direction always printed it;
+ *    null for non-finite values). An
+ *    optional "source" field names the frame (typically, an image file).
+ *
+ *  - BINARY: a 16 bytes header (RESULT_FILE_MAGIC, RESULT_FILE_VERSION and
+ *    sizeof(ResultRecord), as uint32_t), followed by one ResultRecord per
+ *    face. Frames without faces do not appear in the file.
+ *
+ *  - COLUMNAR (and COLUMNAR_LANDMARKS, which also stores the facial
+ *    features): a memory-mappable result store (see result_store.hpp). The
+ *    file name is then the directory of the store.
+ *
+ * The output is only written to the stream when the buffer is full, on
+ * flush(), and on destruction.
+ */
+class ResultWriter {
+
+public:
+
+    enum Format {NDJSON, BINARY, COLUMNAR, COLUMNAR_LANDMARKS};
+
+    ResultWriter(std::ostream& out, Format format = NDJSON, size_t buffer_size = 1 << 16);
+
+    /** Writes to the given file, or to the standard output if `filename` is
+     * empty or "-" (except for the columnar formats). If `append` is true,
+     * the results are appended to the existing ones, if any. Otherwise, an
+     * existing file (or store) is replaced. Check isOpen() before use.
+     */
+    ResultWriter(const std::string& filename, Format format = NDJSON, size_t buffer_size = 1 << 16, bool append = false);
+
+    ~ResultWriter();
+
+    ResultWriter(const ResultWriter&) = delete;
+    ResultWriter& operator=(const ResultWriter&) = delete;
+
+    /** Writes the faces detected in one frame. `track_ids` gives the ID of
+     * each face (by default, its index in `poses`). `features` is only
+     * used by the COLUMNAR_LANDMARKS format.
+     */
+    void write(uint64_t frame_idx,
+               double timestamp,
+               const std::vector<head_pose>& poses,
+               const std::vector<uint32_t>& track_ids = std::vector<uint32_t>(),
+               const std::string& source = "",
+               const std::vector<std::vector<cv::Point>>& features = std::vector<std::vector<cv::Point>>());
+
+    void flush();
+
+    /** How much has been written to the output so far (not counting the
+     * buffered results): in bytes for NDJSON and BINARY, in rows (faces) for
+     * the columnar formats. When appending, this includes the existing
+     * results. Meant to be saved in checkpoints, see truncate().
+     */
+    uint64_t offset() const {return store ? store->size() : written;}
+
+    /** Drops the results written to a file after the given offset(), eg the
+     * results written after the last checkpoint of an interrupted run.
+     * Returns false if the file is shorter than that.
+     */
+    static bool truncate(const std::string& filename, Format format, uint64_t offset);
+
+    /** Appends the results of another file (or store) of the same format,
+     * eg written by another process. Returns false if it can not be read.
+     */
+    bool merge(const std::string& filename);
+
+    /** Deletes a result file (or store).
+     */
+    static bool remove(const std::string& filename, Format format);
+
+    bool isOpen() const {return store ? store->isOpen() : (format == NDJSON || format == BINARY) && out.good();}
+
+    /** Parses a format name ("json", "binary", "columnar" or
+     * "columnar-landmarks"). Returns false if unknown.
+     */
+    static bool parseFormat(const std::string& name, Format& format);
+
+private:
+
+    void writeHeader();
+
+    void writeJson(uint64_t frame_idx,
+                   double timestamp,
+                   const std::vector<head_pose>& poses,
+                   const std::vector<uint32_t>& track_ids,
+                   const std::string& source);
+
+    void writeBinary(uint64_t frame_idx,
+                     double timestamp,
+                     const std::vector<head_pose>& poses,
+                     const std::vector<uint32_t>& track_ids);
+
+    std::ofstream file;
+    std::ostream& out;
+    Format format;
+    size_t buffer_size;
+    std::string buffer;
+    uint64_t written;
+
+    std::unique_ptr<ResultStoreWriter> store; // columnar formats only
+};
+
+#endif // __RESULT_WRITER
@@ -2,6 +2,8 @@
 
 #include "tf/transform_listener.h"
 
+#include "reduced_decoding.hpp"
+
 using namespace std;
 using namespace cv;
 
@@ -12,14 +14,33 @@ using namespace cv;
 
 HeadPoseEstimator::HeadPoseEstimator(ros::NodeHandle& rosNode,
                                      const string& prefix,
-                                     const string& modelFilename):
+                                     const string& modelFilename,
+                                     int reducedDecoding,
+                                     const string& resultsSegment):
             rosNode(rosNode),
             it(rosNode),
             facePrefix(prefix),
-            estimator(modelFilename)
+            estimator(modelFilename),
+            reducedDecoding(reducedDecoding),
+            frameIdx(0)
 
 {
-    sub = it.subscribeCamera("rgb", 1, &HeadPoseEstimator::detectFaces, this);
+    if (!resultsSegment.empty()) {
+        resultPublisher.reset(new ResultPublisher(resultsSegment));
+        if (!resultPublisher->isOpen()) {
+            ROS_ERROR_STREAM("Couldn't create the shared memory segment " << resultsSegment);
+            resultPublisher.reset();
+        }
+    }
+
+    if (reducedDecoding > 1) {
+        auto topic = rosNode.resolveName("rgb");
+        compressed_sub = rosNode.subscribe(topic + "/compressed", 1, &HeadPoseEstimator::detectFacesCompressed, this);
+        camerainfo_sub = rosNode.subscribe(image_transport::getCameraInfoTopic(topic), 1, &HeadPoseEstimator::onCameraInfo, this);
+    }
+    else {
+        sub = it.subscribeCamera("rgb", 1, &HeadPoseEstimator::detectFaces, this);
+    }
 
     nb_detected_faces_pub = rosNode.advertise<std_msgs::Char>("gazr/detected_faces/count", 1);
 
@@ -28,17 +49,22 @@ HeadPoseEstimator::HeadPoseEstimator(ros::NodeHandle& rosNode,
 #endif
 }
 
-void HeadPoseEstimator::detectFaces(const sensor_msgs::ImageConstPtr& rgb_msg, 
-                                    const sensor_msgs::CameraInfoConstPtr& camerainfo)
+void HeadPoseEstimator::updateCameraModel(const sensor_msgs::CameraInfoConstPtr& camerainfo)
 {
-    ROS_INFO_ONCE("First RGB image received");
-
     // updating the camera model is cheap if not modified
     cameramodel.fromCameraInfo(camerainfo);
 
     estimator.focalLength = cameramodel.fx(); 
     estimator.opticalCenterX = cameramodel.cx();
     estimator.opticalCenterY = cameramodel.cy();
+}
+
+void HeadPoseEstimator::detectFaces(const sensor_msgs::ImageConstPtr& rgb_msg, 
+                                    const sensor_msgs::CameraInfoConstPtr& camerainfo)
+{
+    ROS_INFO_ONCE("First RGB image received");
+
+    updateCameraModel(camerainfo);
 
     // hopefully no copy here:
     //  - assignement operator of cv::Mat does not copy the data
@@ -54,6 +80,40 @@ void HeadPoseEstimator::detectFaces(const sensor_msgs::ImageConstPtr& rgb_msg,
 
     auto all_features = estimator.update(rgb);
 
+    publishFaces(rgb_msg->header, rgb, all_features);
+}
+
+void HeadPoseEstimator::detectFacesCompressed(const sensor_msgs::CompressedImageConstPtr& msg)
+{
+    ROS_INFO_ONCE("First compressed RGB image received");
+
+    if (!last_camerainfo) {
+        ROS_WARN_THROTTLE(5, "No camera info received yet. Skipping the image.");
+        return;
+    }
+    updateCameraModel(last_camerainfo);
+
+    auto reduced = decodeReduced(msg->data, reducedDecoding);
+
+    // got an empty image!
+    if (reduced.size().area() == 0) return;
+
+    // the full resolution image is only decoded if some faces are too small
+    Mat full;
+    auto all_features = estimator.update(reduced, 1.f / reducedDecoding,
+                                         [&full, &msg]() {full = decodeFull(msg->data); return full;});
+
+#ifdef HEAD_POSE_ESTIMATION_DEBUG
+    if (full.empty() && pub.getNumSubscribers() > 0) full = decodeFull(msg->data);
+#endif
+
+    publishFaces(msg->header, full, all_features);
+}
+
+void HeadPoseEstimator::publishFaces(const std_msgs::Header& header,
+                                     const Mat& image,
+                                     const std::vector<std::vector<Point>>& all_features)
+{
     auto poses = estimator.poses();
 #ifdef HEAD_POSE_ESTIMATION_DEBUG
     ROS_INFO_STREAM(poses.size() << " faces detected.");
@@ -64,6 +124,12 @@ void HeadPoseEstimator::detectFaces(const sensor_msgs::ImageConstPtr& rgb_msg,
 
     nb_detected_faces_pub.publish(nb_faces);
 
+    if (resultPublisher) resultPublisher->publish(frameIdx++, header.stamp.toSec(), poses);
+
+    // all the faces are broadcast in a single TF message, so that consumers
+    // (like estimate_focus) process them together
+    std::vector<tf::StampedTransform> transforms;
+
     for(size_t face_idx = 0; face_idx < poses.size(); ++face_idx) {
 
         auto trans = poses[face_idx];
@@ -83,10 +149,10 @@ void HeadPoseEstimator::detectFaces(const sensor_msgs::ImageConstPtr& rgb_msg,
         face_pose.setRotation(qrot);
 
         tf::StampedTransform transform(face_pose, 
-                rgb_msg->header.stamp,  // publish the transform with the same timestamp as the frame originally used
+                header.stamp,  // publish the transform with the same timestamp as the frame originally used
                 cameramodel.tfFrame(),
                 facePrefix + "_" + to_string(face_idx));
-        br.sendTransform(transform);
+        transforms.push_back(transform);
 
 //    tf::TransformListener tf;
 //    tf.waitForTransform("face_0", "head_tracking_camera", ros::Time(), ros::Duration(1.0));
@@ -103,11 +169,12 @@ void HeadPoseEstimator::detectFaces(const sensor_msgs::ImageConstPtr& rgb_msg,
 //        ROS_DEBUG_STREAM("Max Rotation in RPY (degree) [" <<  minr*180.0/M_PI << ", " << minp*180.0/M_PI << ", " << miny*180.0/M_PI << "]" << std::endl);
 //
     }
+    br.sendTransform(transforms);
 
 #ifdef HEAD_POSE_ESTIMATION_DEBUG
-    if(pub.getNumSubscribers() > 0) {
+    if(pub.getNumSubscribers() > 0 && !image.empty()) {
         ROS_INFO_ONCE("Starting to publish face tracking output for debug");
-        auto debugmsg = cv_bridge::CvImage(rgb_msg->header, "bgr8", estimator.drawDetections(rgb, all_features, poses)).toImageMsg();
+        auto debugmsg = cv_bridge::CvImage(header, "bgr8", estimator.drawDetections(image, all_features, poses)).toImageMsg();
         pub.publish(debugmsg);
     }
 #endif
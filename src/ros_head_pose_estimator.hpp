@@ -1,7 +1,9 @@
 #include <string>
 #include <set>
+#include <memory>
 
 #include "head_pose_estimation.hpp"
+#include "result_publisher.hpp"
 
 // opencv2
 #include <opencv2/core/core.hpp>
@@ -11,6 +13,8 @@
 #include <std_msgs/Char.h>
 #include <tf/transform_broadcaster.h>
 #include <image_transport/image_transport.h>
+#include <image_transport/camera_common.h>
+#include <sensor_msgs/CompressedImage.h>
 
 #include <image_geometry/pinhole_camera_model.h>
 
@@ -21,15 +25,28 @@ class HeadPoseEstimator
 {
 public:
 
+    /** If reducedDecoding > 1 (2, 4 or 8), subscribes to the compressed
+     * image stream instead, and decodes it reducedDecoding times smaller
+     * for face detection (see HeadPoseEstimation::update).
+     *
+     * If resultsSegment is not empty (eg "/gazr-results"), the results of
+     * the last frame are also published in that shared memory segment, for
+     * the local processes that can not afford the TF latency (see
+     * result_publisher.hpp).
+     */
     HeadPoseEstimator(ros::NodeHandle& rosNode,
                       const std::string& prefix,
-                      const std::string& modelFilename = "");
+                      const std::string& modelFilename = "",
+                      int reducedDecoding = 1,
+                      const std::string& resultsSegment = "");
 
 private:
 
     ros::NodeHandle& rosNode;
     image_transport::ImageTransport it;
     image_transport::CameraSubscriber sub;
+    ros::Subscriber compressed_sub;
+    ros::Subscriber camerainfo_sub;
     image_transport::Publisher pub;
 
     ros::Publisher nb_detected_faces_pub;
@@ -38,6 +55,7 @@ private:
     tf::Transform transform;
 
     image_geometry::PinholeCameraModel cameramodel;
+    sensor_msgs::CameraInfoConstPtr last_camerainfo;
     cv::Mat cameraMatrix, distCoeffs;
 
     cv::Mat inputImage;
@@ -46,7 +64,22 @@ private:
     // prefix prepended to TF frames generated for each frame
     std::string facePrefix;
 
+    int reducedDecoding;
+
+    std::unique_ptr<ResultPublisher> resultPublisher;
+    uint64_t frameIdx;
+
+    void updateCameraModel(const sensor_msgs::CameraInfoConstPtr& camerainfo);
+
     void detectFaces(const sensor_msgs::ImageConstPtr& msg,
                      const sensor_msgs::CameraInfoConstPtr& camerainfo);
+
+    void detectFacesCompressed(const sensor_msgs::CompressedImageConstPtr& msg);
+
+    void onCameraInfo(const sensor_msgs::CameraInfoConstPtr& camerainfo) {last_camerainfo = camerainfo;}
+
+    void publishFaces(const std_msgs::Header& header,
+                      const cv::Mat& image,
+                      const std::vector<std::vector<cv::Point>>& all_features);
 };
 
@@ -0,0 +1,349 @@
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <fstream>
+#include <sstream>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#include "scene_mesh.hpp"
+
+using namespace std;
+
+// triangles whose determinant is below that are considered parallel to the ray
+static const float EPSILON = 1e-9;
+
+static const uint32_t NO_TRIANGLE = numeric_limits<uint32_t>::max();
+
+bool SceneMesh::load(const string& filename)
+{
+    ifstream file(filename);
+    if (!file.is_open()) return false;
+
+    vector<float> obj_vertices;
+    string object = "scene";
+
+    string line;
+    while (getline(file, line)) {
+        istringstream ss(line);
+        string keyword;
+        ss >> keyword;
+
+        if (keyword == "v") {
+            float x, y, z;
+            if (!(ss >> x >> y >> z)) return false;
+            obj_vertices.push_back(x);
+            obj_vertices.push_back(y);
+            obj_vertices.push_back(z);
+        }
+        else if (keyword == "o" || keyword == "g") {
+            string name;
+            ss >> name;
+            if (!name.empty()) object = name;
+        }
+        else if (keyword == "f") {
+            const long nb_vertices = obj_vertices.size() / 3;
+
+            vector<long> face;
+            string vertex;
+            while (ss >> vertex) {
+                // faces are written 'v', 'v/vt', 'v//vn' or 'v/vt/vn'. Negative
+                // indices are relative to the end of the vertex list.
+                char* end;
+                long idx = strtol(vertex.c_str(), &end, 10);
+                if (end == vertex.c_str()) return false;
+                if (idx < 0) idx += nb_vertices + 1;
+                if (idx < 1 || idx > nb_vertices) return false;
+                face.push_back(idx - 1);
+            }
+
+            // triangulate the polygon as a fan
+            for (size_t k = 2; k < face.size(); ++k) {
+                addTriangle(&obj_vertices[3 * face[0]],
+                            &obj_vertices[3 * face[k - 1]],
+                            &obj_vertices[3 * face[k]],
+                            object);
+            }
+        }
+    }
+
+    return true;
+}
+
+void SceneMesh::addTriangle(const float v0[3], const float v1[3], const float v2[3],
+                            const string& object)
+{
+    vertices.insert(vertices.end(), v0, v0 + 3);
+    vertices.insert(vertices.end(), v1, v1 + 3);
+    vertices.insert(vertices.end(), v2, v2 + 3);
+
+    // triangles of a given object are usually added together
+    if (object_names.empty() || object_names.back() != object) {
+        auto it = find(object_names.begin(), object_names.end(), object);
+        if (it == object_names.end()) {
+            object_names.push_back(object);
+            it = object_names.end() - 1;
+        }
+        triangle_objects.push_back(it - object_names.begin());
+    }
+    else {
+        triangle_objects.push_back(object_names.size() - 1);
+    }
+}
+
+void SceneMesh::build()
+{
+    nodes.clear();
+    packets.clear();
+
+    vector<uint32_t> triangles(nbTriangles());
+    iota(triangles.begin(), triangles.end(), 0);
+
+    if (triangles.empty()) return;
+
+    buildNode(triangles, 0, triangles.size());
+}
+
+uint32_t SceneMesh::buildNode(vector<uint32_t>& triangles, uint32_t first, uint32_t count)
+{
+    uint32_t node_idx = nodes.size();
+    nodes.push_back(Node());
+
+    Node node;
+    fill(node.min, node.min + 3, numeric_limits<float>::max());
+    fill(node.max, node.max + 3, numeric_limits<float>::lowest());
+
+    // bounding box of the triangles' centroids, to choose the split axis
+    float centroids_min[3], centroids_max[3];
+    fill(centroids_min, centroids_min + 3, numeric_limits<float>::max());
+    fill(centroids_max, centroids_max + 3, numeric_limits<float>::lowest());
+
+    for (uint32_t k = first; k < first + count; ++k) {
+        const float* v = &vertices[9 * triangles[k]];
+        for (size_t axis = 0; axis < 3; ++axis) {
+            for (size_t corner = 0; corner < 3; ++corner) {
+                node.min[axis] = min(node.min[axis], v[3 * corner + axis]);
+                node.max[axis] = max(node.max[axis], v[3 * corner + axis]);
+            }
+            const float centroid = v[axis] + v[3 + axis] + v[6 + axis];
+            centroids_min[axis] = min(centroids_min[axis], centroid);
+            centroids_max[axis] = max(centroids_max[axis], centroid);
+        }
+    }
+
+    if (count <= MAX_TRIANGLES_PER_LEAF) {
+        node.first = packets.size();
+        node.count = (count + 3) / 4;
+
+        for (uint32_t k = 0; k < count; k += 4) {
+            TrianglePacket packet;
+            for (size_t lane = 0; lane < 4; ++lane) {
+                if (k + lane < count) {
+                    auto triangle = triangles[first + k + lane];
+                    const float* v = &vertices[9 * triangle];
+                    packet.v0x[lane] = v[0]; packet.v0y[lane] = v[1]; packet.v0z[lane] = v[2];
+                    packet.e1x[lane] = v[3] - v[0]; packet.e1y[lane] = v[4] - v[1]; packet.e1z[lane] = v[5] - v[2];
+                    packet.e2x[lane] = v[6] - v[0]; packet.e2y[lane] = v[7] - v[1]; packet.e2z[lane] = v[8] - v[2];
+                    packet.triangle[lane] = triangle;
+                }
+                else {
+                    // padding: a degenerated triangle, never hit
+                    packet.v0x[lane] = packet.v0y[lane] = packet.v0z[lane] = 0;
+                    packet.e1x[lane] = packet.e1y[lane] = packet.e1z[lane] = 0;
+                    packet.e2x[lane] = packet.e2y[lane] = packet.e2z[lane] = 0;
+                    packet.triangle[lane] = NO_TRIANGLE;
+                }
+            }
+            packets.push_back(packet);
+        }
+
+        nodes[node_idx] = node;
+        return node_idx;
+    }
+
+    // split at the median centroid along the largest dimension
+    size_t split_axis = 0;
+    for (size_t axis = 1; axis < 3; ++axis) {
+        if (centroids_max[axis] - centroids_min[axis] > centroids_max[split_axis] - centroids_min[split_axis]) {
+            split_axis = axis;
+        }
+    }
+
+    const uint32_t half = count / 2;
+    nth_element(triangles.begin() + first,
+                triangles.begin() + first + half,
+                triangles.begin() + first + count,
+                [this, split_axis](uint32_t a, uint32_t b) {
+                    const float* va = &vertices[9 * a];
+                    const float* vb = &vertices[9 * b];
+                    return va[split_axis] + va[3 + split_axis] + va[6 + split_axis] <
+                           vb[split_axis] + vb[3 + split_axis] + vb[6 + split_axis];
+                });
+
+    node.count = 0;
+    nodes[node_idx] = node;
+
+    buildNode(triangles, first, half); // left child: node_idx + 1
+    // (building the right child reallocates `nodes`)
+    auto right_child = buildNode(triangles, first + half, count - half);
+    nodes[node_idx].first = right_child;
+
+    return node_idx;
+}
+
+/** Slab test between the ray and the box, limited to [0, max_distance].
+ */
+static inline bool intersectsBox(const float box_min[3], const float box_max[3],
+                                 const float origin[3], const float inv_direction[3],
+                                 float max_distance)
+{
+    float tmin = 0, tmax = max_distance;
+    for (size_t axis = 0; axis < 3; ++axis) {
+        const float t1 = (box_min[axis] - origin[axis]) * inv_direction[axis];
+        const float t2 = (box_max[axis] - origin[axis]) * inv_direction[axis];
+        tmin = max(tmin, min(t1, t2));
+        tmax = min(tmax, max(t1, t2));
+    }
+    return tmin <= tmax;
+}
+
+void SceneMesh::intersect(const TrianglePacket& p,
+                          float ox, float oy, float oz,
+                          float dx, float dy, float dz,
+                          RayHit& hit) const
+{
+    // Moller-Trumbore, on 4 triangles at once
+    float distances[4];
+    int hits = 0;
+
+#ifdef __SSE__
+    const __m128 d_x = _mm_set1_ps(dx), d_y = _mm_set1_ps(dy), d_z = _mm_set1_ps(dz);
+    const __m128 e1x = _mm_loadu_ps(p.e1x), e1y = _mm_loadu_ps(p.e1y), e1z = _mm_loadu_ps(p.e1z);
+    const __m128 e2x = _mm_loadu_ps(p.e2x), e2y = _mm_loadu_ps(p.e2y), e2z = _mm_loadu_ps(p.e2z);
+
+    // p = d x e2
+    const __m128 px = _mm_sub_ps(_mm_mul_ps(d_y, e2z), _mm_mul_ps(d_z, e2y));
+    const __m128 py = _mm_sub_ps(_mm_mul_ps(d_z, e2x), _mm_mul_ps(d_x, e2z));
+    const __m128 pz = _mm_sub_ps(_mm_mul_ps(d_x, e2y), _mm_mul_ps(d_y, e2x));
+
+    const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+    const __m128 inv_det = _mm_div_ps(_mm_set1_ps(1.f), det);
+
+    // t = o - v0
+    const __m128 tx = _mm_sub_ps(_mm_set1_ps(ox), _mm_loadu_ps(p.v0x));
+    const __m128 ty = _mm_sub_ps(_mm_set1_ps(oy), _mm_loadu_ps(p.v0y));
+    const __m128 tz = _mm_sub_ps(_mm_set1_ps(oz), _mm_loadu_ps(p.v0z));
+
+    const __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), inv_det);
+
+    // q = t x e1
+    const __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+    const __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+    const __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+
+    const __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(d_x, qx), _mm_mul_ps(d_y, qy)), _mm_mul_ps(d_z, qz)), inv_det);
+    const __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv_det);
+
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 abs_det = _mm_andnot_ps(_mm_set1_ps(-0.f), det);
+
+    __m128 mask = _mm_cmpgt_ps(abs_det, _mm_set1_ps(EPSILON));
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(u, zero));
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(v, zero));
+    mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.f)));
+    mask = _mm_and_ps(mask, _mm_cmpgt_ps(t, zero));
+    mask = _mm_and_ps(mask, _mm_cmplt_ps(t, _mm_set1_ps(hit.distance)));
+
+    _mm_storeu_ps(distances, t);
+    hits = _mm_movemask_ps(mask);
+#else
+    for (size_t lane = 0; lane < 4; ++lane) {
+        const float px = dy * p.e2z[lane] - dz * p.e2y[lane];
+        const float py = dz * p.e2x[lane] - dx * p.e2z[lane];
+        const float pz = dx * p.e2y[lane] - dy * p.e2x[lane];
+
+        const float det = p.e1x[lane] * px + p.e1y[lane] * py + p.e1z[lane] * pz;
+        if (fabs(det) <= EPSILON) continue;
+        const float inv_det = 1.f / det;
+
+        const float tx = ox - p.v0x[lane], ty = oy - p.v0y[lane], tz = oz - p.v0z[lane];
+        const float u = (tx * px + ty * py + tz * pz) * inv_det;
+
+        const float qx = ty * p.e1z[lane] - tz * p.e1y[lane];
+        const float qy = tz * p.e1x[lane] - tx * p.e1z[lane];
+        const float qz = tx * p.e1y[lane] - ty * p.e1x[lane];
+
+        const float v = (dx * qx + dy * qy + dz * qz) * inv_det;
+        distances[lane] = (p.e2x[lane] * qx + p.e2y[lane] * qy + p.e2z[lane] * qz) * inv_det;
+
+        if (u >= 0 && v >= 0 && u + v <= 1 && distances[lane] > 0 && distances[lane] < hit.distance) {
+            hits |= 1 << lane;
+        }
+    }
+#endif
+
+    for (size_t lane = 0; lane < 4; ++lane) {
+        if ((hits & (1 << lane)) && distances[lane] < hit.distance) {
+            hit.distance = distances[lane];
+            hit.triangle = p.triangle[lane];
+        }
+    }
+}
+
+bool SceneMesh::raycast(float ox, float oy, float oz,
+                        float dx, float dy, float dz,
+                        RayHit& hit) const
+{
+    hit.distance = numeric_limits<float>::max();
+    hit.triangle = NO_TRIANGLE;
+
+    if (nodes.empty()) return false;
+
+    const float norm = sqrt(dx * dx + dy * dy + dz * dz);
+    if (norm == 0) return false;
+    dx /= norm; dy /= norm; dz /= norm;
+
+    const float origin[3] = {ox, oy, oz};
+    const float inv_direction[3] = {1.f / dx, 1.f / dy, 1.f / dz};
+
+    uint32_t stack[64];
+    size_t stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while (stack_size > 0) {
+        const auto node_idx = stack[--stack_size];
+        const auto& node = nodes[node_idx];
+
+        if (!intersectsBox(node.min, node.max, origin, inv_direction, hit.distance)) continue;
+
+        if (node.count > 0) {
+            for (uint32_t k = node.first; k < node.first + node.count; ++k) {
+                intersect(packets[k], ox, oy, oz, dx, dy, dz, hit);
+            }
+        }
+        else {
+            stack[stack_size++] = node.first;
+            stack[stack_size++] = node_idx + 1;
+        }
+    }
+
+    if (hit.triangle == NO_TRIANGLE) return false;
+
+    hit.x = ox + dx * hit.distance;
+    hit.y = oy + dy * hit.distance;
+    hit.z = oz + dz * hit.distance;
+    hit.object = triangle_objects[hit.triangle];
+
+    return true;
+}
+
+bool SceneMesh::raycast(const Observers& observers, size_t observer_idx, RayHit& hit) const
+{
+    return raycast(observers.x[observer_idx], observers.y[observer_idx], observers.z[observer_idx],
+                   observers.dx[observer_idx], observers.dy[observer_idx], observers.dz[observer_idx],
+                   hit);
+}
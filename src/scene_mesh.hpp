@@ -0,0 +1,101 @@
+#ifndef __SCENE_MESH
+#define __SCENE_MESH
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "attention.hpp"
+
+/** Where a ray hits the scene.
+ */
+struct RayHit {
+    float distance;
+    float x, y, z;
+    size_t triangle; // index of the triangle, in the order they were added
+    size_t object;   // index of the object the triangle belongs to
+};
+
+/** A static triangle mesh of the environment, that head directions can be
+ * intersected with.
+ *
+ * The triangles are stored in a bounding volume hierarchy, built once by
+ * build(). The leaves store the triangles by packets of 4, which are tested
+ * against the ray at once (with SSE when available).
+ */
+class SceneMesh {
+
+public:
+
+    SceneMesh() {}
+
+    /** Loads the triangles of a Wavefront OBJ file (polygons are triangulated).
+     * Each object ('o') or group ('g') of the file becomes one object of the
+     * scene. Does not build the hierarchy. Returns false if the file can not
+     * be read.
+     */
+    bool load(const std::string& filename);
+
+    /** Adds a triangle to the given object (created if needed).
+     */
+    void addTriangle(const float v0[3], const float v1[3], const float v2[3],
+                     const std::string& object);
+
+    /** Builds the bounding volume hierarchy. Must be called after the
+     * triangles are added, and before raycast().
+     */
+    void build();
+
+    /** Intersects the ray (origin o, direction d) with the scene. Returns false
+     * if nothing is hit.
+     */
+    bool raycast(float ox, float oy, float oz,
+                 float dx, float dy, float dz,
+                 RayHit& hit) const;
+
+    /** Intersects the main axis of the field of view of the given observer
+     * with the scene.
+     */
+    bool raycast(const Observers& observers, size_t observer_idx, RayHit& hit) const;
+
+    size_t nbTriangles() const {return triangle_objects.size();}
+
+    const std::vector<std::string>& objects() const {return object_names;}
+
+private:
+
+    static const size_t MAX_TRIANGLES_PER_LEAF = 8;
+
+    struct Node {
+        float min[3], max[3];
+        // leaf: range [first, first + count) of the packets.
+        // internal node (count == 0): the left child is the next node,
+        // `first` is the index of the right child.
+        uint32_t first, count;
+    };
+
+    // 4 triangles, stored as a structure of arrays: a vertex and two edges
+    struct TrianglePacket {
+        float v0x[4], v0y[4], v0z[4];
+        float e1x[4], e1y[4], e1z[4];
+        float e2x[4], e2y[4], e2z[4];
+        uint32_t triangle[4];
+    };
+
+    uint32_t buildNode(std::vector<uint32_t>& triangles, uint32_t first, uint32_t count);
+
+    void intersect(const TrianglePacket& packet,
+                   float ox, float oy, float oz,
+                   float dx, float dy, float dz,
+                   RayHit& hit) const;
+
+    // 3 vertices per triangle, 3 coordinates per vertex
+    std::vector<float> vertices;
+    std::vector<uint32_t> triangle_objects;
+    std::vector<std::string> object_names;
+
+    std::vector<Node> nodes;
+    std::vector<TrianglePacket> packets;
+};
+
+#endif // __SCENE_MESH
@@ -0,0 +1,86 @@
+#ifndef __SPSC_QUEUE
+#define __SPSC_QUEUE
+
+#include <vector>
+#include <atomic>
+#include <cstddef>
+
+/** A bounded, lock-free queue for exactly one producer thread and one
+ * consumer thread.
+ *
+ * Each side only writes its own index (with release semantics) and reads
+ * the other's (with acquire semantics): no lock, no compare-and-swap. The
+ * indices are kept on different cache lines, so that the producer and the
+ * consumer do not invalidate each other's cache line on every operation.
+ *
+ * The queue never blocks: it is up to the threads to wait (or do something
+ * else) when it is empty or full.
+ */
+template<typename T>
+class SpscQueue {
+
+public:
+
+    explicit SpscQueue(size_t capacity) :
+        slots(capacity + 1), // one slot is always free, to tell full from empty
+        head(0),
+        tail(0)
+    {}
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    /** Producer side. Returns false (and leaves `item` untouched) if the
+     * queue is full.
+     */
+    bool tryPush(T& item)
+    {
+        const auto current_tail = tail.load(std::memory_order_relaxed);
+        const auto next_tail = next(current_tail);
+        if (next_tail == head.load(std::memory_order_acquire)) return false;
+
+        slots[current_tail] = std::move(item);
+        tail.store(next_tail, std::memory_order_release);
+        return true;
+    }
+
+    /** Consumer side. Returns false if the queue is empty.
+     */
+    bool tryPop(T& item)
+    {
+        const auto current_head = head.load(std::memory_order_relaxed);
+        if (current_head == tail.load(std::memory_order_acquire)) return false;
+
+        item = std::move(slots[current_head]);
+        slots[current_head] = T(); // do not hold the resources of the item
+        head.store(next(current_head), std::memory_order_release);
+        return true;
+    }
+
+    /** Number of items in the queue. Only a snapshot, when called from
+     * another thread than the producer and the consumer.
+     */
+    size_t size() const
+    {
+        const auto current_head = head.load(std::memory_order_acquire);
+        const auto current_tail = tail.load(std::memory_order_acquire);
+        return current_tail >= current_head ? current_tail - current_head
+                                            : current_tail + slots.size() - current_head;
+    }
+
+    size_t capacity() const {return slots.size() - 1;}
+
+private:
+
+    size_t next(size_t index) const {return index + 1 == slots.size() ? 0 : index + 1;}
+
+    std::vector<T> slots;
+
+    // padded rather than alignas(64): C++11 does not honour over-alignment
+    // on the heap
+    std::atomic<size_t> head; // next item to pop (written by the consumer)
+    char padding[64];
+    std::atomic<size_t> tail; // next free slot (written by the producer)
+};
+
+#endif // __SPSC_QUEUE
@@ -0,0 +1,87 @@
+#ifndef __THREAD_POOL
+#define __THREAD_POOL
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+
+/** A fixed-size pool of threads running tasks in submission order.
+ *
+ * The destructor waits for all the pending tasks to complete.
+ */
+class ThreadPool {
+
+public:
+
+    explicit ThreadPool(size_t nb_threads) : stopping(false)
+    {
+        if (nb_threads == 0) nb_threads = 1;
+        for (size_t i = 0; i < nb_threads; ++i) {
+            workers.emplace_back([this] {run();});
+        }
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        condition.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /** Queues a task, and returns a future holding its result (or the
+     * exception it threw).
+     */
+    template<class F>
+    auto submit(F&& f) -> std::future<decltype(f())>
+    {
+        typedef decltype(f()) Result;
+
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(f));
+        auto result = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push([task] {(*task)();});
+        }
+        condition.notify_one();
+        return result;
+    }
+
+    size_t size() const {return workers.size();}
+
+private:
+
+    void run()
+    {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [this] {return stopping || !tasks.empty();});
+                if (tasks.empty()) return; // stopping, and nothing left to do
+                task = std::move(tasks.front());
+                tasks.pop();
+            }
+            task();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stopping;
+};
+
+#endif // __THREAD_POOL
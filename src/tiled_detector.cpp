@@ -0,0 +1,104 @@
+#include <algorithm>
+#include <future>
+
+#include "tiled_detector.hpp"
+
+using namespace std;
+
+TiledDetector::TiledDetector(const HeadPoseEstimation& prototype, size_t nb_threads, int tile_size, int overlap) :
+    tile_size(tile_size),
+    overlap(overlap),
+    detectors(max<size_t>(nb_threads, 1), prototype),
+    pool(new ThreadPool(max<size_t>(nb_threads, 1)))
+{
+}
+
+TiledDetector::TiledDetector(const BatchedDetector::BatchFunction& detect_batch, int tile_size, int overlap) :
+    tile_size(tile_size),
+    overlap(overlap),
+    detect_batch(detect_batch)
+{
+}
+
+vector<cv::Rect> TiledDetector::tiles(cv::Size image_size, int tile_size, int overlap)
+{
+    // positions of the tiles along one axis: evenly spread, the last one
+    // ending on the border of the image
+    auto positions = [tile_size, overlap](int length) {
+        vector<int> result;
+        if (length <= tile_size) {
+            result.push_back(0);
+            return result;
+        }
+        const int step = max(tile_size - overlap, 1);
+        const int nb_tiles = (length - tile_size + step - 1) / step + 1;
+        for (int i = 0; i < nb_tiles; ++i) {
+            result.push_back(static_cast<int>(static_cast<int64_t>(i) * (length - tile_size) / (nb_tiles - 1)));
+        }
+        return result;
+    };
+
+    const int width = min(tile_size, image_size.width);
+    const int height = min(tile_size, image_size.height);
+
+    vector<cv::Rect> result;
+    for (auto y : positions(image_size.height)) {
+        for (auto x : positions(image_size.width)) {
+            result.push_back(cv::Rect(x, y, width, height));
+        }
+    }
+    return result;
+}
+
+vector<cv::Rect> TiledDetector::nonMaximumSuppression(vector<cv::Rect> boxes, double threshold)
+{
+    sort(boxes.begin(), boxes.end(), [](const cv::Rect& a, const cv::Rect& b) {return a.area() > b.area();});
+
+    vector<cv::Rect> kept;
+    for (const auto& box : boxes) {
+        bool duplicate = false;
+        for (const auto& other : kept) {
+            // `box` is the smaller one
+            if ((box & other).area() > threshold * box.area()) {
+                duplicate = true;
+                break;
+            }
+        }
+        if (!duplicate) kept.push_back(box);
+    }
+    return kept;
+}
+
+vector<cv::Rect> TiledDetector::detect(const cv::Mat& image)
+{
+    const auto image_tiles = tiles(image.size(), tile_size, overlap);
+
+    vector<cv::Mat> tile_images;
+    for (const auto& tile : image_tiles) tile_images.push_back(image(tile));
+
+    vector<vector<cv::Rect>> tile_faces(image_tiles.size());
+
+    if (detect_batch) {
+        tile_faces = detect_batch(tile_images);
+    }
+    else {
+        // thread i detects the faces of the tiles i, i + nb_threads...
+        vector<future<void>> results;
+        for (size_t i = 0; i < detectors.size() && i < image_tiles.size(); ++i) {
+            results.push_back(pool->submit([this, i, &tile_images, &tile_faces] {
+                for (size_t j = i; j < tile_images.size(); j += detectors.size()) {
+                    tile_faces[j] = detectors[i].detectFaces(tile_images[j]);
+                }
+            }));
+        }
+        for (auto& result : results) result.get();
+    }
+
+    vector<cv::Rect> faces;
+    for (size_t i = 0; i < image_tiles.size() && i < tile_faces.size(); ++i) {
+        for (const auto& face : tile_faces[i]) {
+            faces.push_back(face + image_tiles[i].tl());
+        }
+    }
+    return nonMaximumSuppression(faces);
+}
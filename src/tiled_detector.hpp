@@ -0,0 +1,67 @@
+#ifndef __TILED_DETECTOR
+#define __TILED_DETECTOR
+
+#include <vector>
+#include <memory>
+
+#include "head_pose_estimation.hpp"
+#include "batched_detector.hpp"
+#include "thread_pool.hpp"
+
+/** Face detection on very large frames (4K, panoramic...), split into
+ * overlapping tiles that are processed in parallel.
+ *
+ * All the tiles have the same size (`tile_size` x `tile_size`, or the
+ * frame size if smaller), and consecutive tiles overlap by at least
+ * `overlap` pixels: any face smaller than `overlap` is entirely within at
+ * least one tile. The faces detected twice in the overlaps are then merged
+ * (see nonMaximumSuppression()).
+ *
+ * The tiles must be larger than the smallest face the detector can find
+ * (80 pixels for the default detector). Smaller tiles give more tasks to
+ * run in parallel, but more pixels are processed twice.
+ *
+ * The detected faces are in frame coordinates, to be passed to
+ * HeadPoseEstimation::fitFaces(). A TiledDetector is not thread-safe.
+ */
+class TiledDetector {
+
+public:
+
+    /** Detects the faces of the tiles on `nb_threads` threads, with copies
+     * of `prototype`'s detector.
+     */
+    TiledDetector(const HeadPoseEstimation& prototype, size_t nb_threads, int tile_size = 512, int overlap = 160);
+
+    /** Detects the faces of all the tiles of a frame in a single batch, eg
+     * with the CNN detector (see cnn_face_detector.hpp).
+     */
+    TiledDetector(const BatchedDetector::BatchFunction& detect_batch, int tile_size = 512, int overlap = 160);
+
+    TiledDetector(const TiledDetector&) = delete;
+    TiledDetector& operator=(const TiledDetector&) = delete;
+
+    std::vector<cv::Rect> detect(const cv::Mat& image);
+
+    /** The tiles of an image of the given size.
+     */
+    static std::vector<cv::Rect> tiles(cv::Size image_size, int tile_size, int overlap);
+
+    /** Merges the boxes that overlap by more than `threshold` of the
+     * smaller one (a face detected in two tiles, or cut by a tile border),
+     * keeping the largest.
+     */
+    static std::vector<cv::Rect> nonMaximumSuppression(std::vector<cv::Rect> boxes, double threshold = 0.5);
+
+private:
+
+    int tile_size;
+    int overlap;
+
+    std::vector<HeadPoseEstimation> detectors; // one per thread
+    std::unique_ptr<ThreadPool> pool;
+
+    BatchedDetector::BatchFunction detect_batch;
+};
+
+#endif // __TILED_DETECTOR
@@ -0,0 +1,97 @@
+#ifndef __CHECKPOINT
+#define __CHECKPOINT
+
+#include <string>
+#include <fstream>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+
+#include "../src/result_writer.hpp"
+
+/** Progress of a long offline job, saved periodically so that the job can be
+ * resumed after a crash (see the --resume option of the tools).
+ *
+ * A checkpoint records the index of the next input (image or frame) to
+ * process, and the ResultWriter::offset() of the results once everything
+ * before that input has been written and flushed. To resume, the results
+ * are truncated back to that offset (dropping whatever was written after the
+ * checkpoint), and the processing restarts from that input: no result is
+ * computed nor written twice.
+ *
+ * The checkpoint is a small text file, atomically replaced on save.
+ */
+class Checkpoint {
+
+public:
+
+    /** `job` describes the job (typically its input and the parameters
+     * that change the list of inputs): a checkpoint is only loaded by the
+     * same job. A checkpoint is saved at most every `period` seconds.
+     */
+    Checkpoint(const std::string& filename, const std::string& job, double period = 60) :
+        filename(filename),
+        job(job),
+        period(period),
+        last_save(std::chrono::steady_clock::now())
+    {}
+
+    /** Reads the checkpoint. Returns false if there is none, or if it was
+     * saved by another job.
+     */
+    bool load(size_t& next_index, uint64_t& offset) const
+    {
+        std::ifstream file(filename);
+        std::string magic, key, saved_job;
+        int version;
+
+        if (!(file >> magic >> version) || magic != "gazr-checkpoint" || version != 1) return false;
+        if (!(file >> key >> next_index) || key != "next") return false;
+        if (!(file >> key >> offset) || key != "offset") return false;
+        if (!(file >> key) || key != "job") return false;
+        file.get(); // space after the key
+        std::getline(file, saved_job);
+
+        return saved_job == job;
+    }
+
+    /** Flushes the results, and saves a checkpoint if the previous one is
+     * older than the period. To be called once all the inputs before
+     * `next_index` have been written.
+     */
+    void update(size_t next_index, ResultWriter& writer)
+    {
+        if (std::chrono::steady_clock::now() - last_save < std::chrono::duration<double>(period)) return;
+        save(next_index, writer);
+    }
+
+    /** Flushes the results, and saves a checkpoint. Returns false if it
+     * could not be written.
+     */
+    bool save(size_t next_index, ResultWriter& writer)
+    {
+        writer.flush();
+        last_save = std::chrono::steady_clock::now();
+
+        // write aside and rename, so that a crash never leaves a partial checkpoint
+        const auto tmp_filename = filename + ".tmp";
+        {
+            std::ofstream file(tmp_filename);
+            file << "gazr-checkpoint 1\n"
+                 << "next " << next_index << "\n"
+                 << "offset " << writer.offset() << "\n"
+                 << "job " << job << "\n";
+            if (!file.flush()) return false;
+        }
+        return std::rename(tmp_filename.c_str(), filename.c_str()) == 0;
+    }
+
+private:
+
+    std::string filename;
+    std::string job;
+    double period;
+    std::chrono::steady_clock::time_point last_save;
+};
+
+#endif // __CHECKPOINT
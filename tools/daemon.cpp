@@ -0,0 +1,74 @@
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <atomic>
+#include <thread>
+#include <csignal>
+
+#include "../src/head_pose_estimation.hpp"
+#include "../src/frame_service.hpp"
+
+#define STR_EXPAND(tok) #tok
+#define STR(tok) STR_EXPAND(tok)
+
+using namespace std;
+namespace po = boost::program_options;
+
+static std::atomic<bool> stop(false);
+
+static void onSignal(int)
+{
+    stop = true;
+}
+
+int main(int argc, char **argv)
+{
+    po::positional_options_description p;
+    p.add("model", 1);
+
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help,h", "produce help message")
+        ("version,v", "shows version and exits")
+        ("model", po::value<string>(), "dlib's trained face model")
+        ("threads,j", po::value<size_t>()->default_value(std::thread::hardware_concurrency()), "number of parallel estimators, shared by all the clients")
+        ("service", po::value<string>()->default_value(FRAME_SERVICE_DEFAULT_NAME), "name of the service (the clients connect to it by name)")
+        ("focal-length", po::value<float>()->default_value(500), "focal length of the cameras, in pixels");
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(desc).positional(p).run(), vm);
+    po::notify(vm);
+
+    if (vm.count("version")) {
+        cout << argv[0] << " " << STR(GAZR_VERSION) << "\n";
+        return 0;
+    }
+
+    if (vm.count("help") || vm.count("model") == 0) {
+        cerr << argv[0] << " " << STR(GAZR_VERSION) << "\n\nUsage: "
+             << endl << argv[0] << " [options] model.dat\n\n"
+             << "Serves head pose estimation to the local processes using FrameClient\n"
+             << "(see src/frame_service.hpp), through shared memory.\n\n" << desc << endl;
+        return 1;
+    }
+
+    auto estimator = HeadPoseEstimation(vm["model"].as<string>());
+    estimator.focalLength = vm["focal-length"].as<float>();
+
+    const auto service_name = vm["service"].as<string>();
+    const auto nb_threads = max<size_t>(vm["threads"].as<size_t>(), 1);
+
+    FrameService service(estimator, nb_threads, service_name);
+    if (!service.isOpen()) {
+        cerr << "Couldn't create the service " << service_name << endl;
+        return 1;
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    cerr << "Serving " << service_name << " with " << nb_threads << " estimators (Ctrl+C to stop)" << endl;
+    service.run(stop);
+
+    cerr << "Processed " << service.nbFrames() << " frame(s)" << endl;
+    return 0;
+}
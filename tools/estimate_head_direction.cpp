@@ -4,7 +4,10 @@
 #include <opencv2/opencv.hpp>
 
 #include "../src/head_pose_estimation.hpp"
-#include "LinearMath/Matrix3x3.h"
+#include "../src/result_writer.hpp"
+#include "../src/result_publisher.hpp"
+#include "../src/tiled_detector.hpp"
+#include "offline_video_pipeline.hpp"
 
 #define STR_EXPAND(tok) #tok
 #define STR(tok) STR_EXPAND(tok)
@@ -13,8 +16,6 @@ using namespace std;
 using namespace cv;
 namespace po = boost::program_options;
 
-inline double todeg(double rad) { return rad * 180 / M_PI; }
-
 int main(int argc, char **argv) {
     Mat frame;
     bool show_frame = false;
@@ -27,8 +28,40 @@ int main(int argc, char **argv) {
     desc.add_options()("help,h", "produce help message")(
         "version,v", "shows version and exits")(
         "show,s", "display the image with gaze estimation")(
+        "output,o", po::value<string>()->default_value("-"),
+        "file the results are written to (default: standard output)")(
+        "format", po::value<string>()->default_value("json"),
+        "format of the results: json (one JSON object per frame and per line), binary, columnar or columnar-landmarks (memory-mappable result store in the --output directory)")(
         "model", po::value<string>(), "dlib's trained face model")(
-        "image", po::value<string>(), "image to process (png, jpg)");
+        "image", po::value<string>(), "image to process (png, jpg)")(
+        "video", po::value<string>(),
+        "video file to process offline, as fast as possible, on several cores")(
+        "threads,j", po::value<size_t>()->default_value(std::thread::hardware_concurrency()),
+        "video: number of parallel estimators; image/camera with --tile-size: number of tiles processed in parallel")(
+        "chunk-size", po::value<size_t>()->default_value(100),
+        "video: number of consecutive frames processed by the same estimator")(
+        "overlap", po::value<size_t>()->default_value(0),
+        "video: number of frames of the previous chunk re-processed to warm up the estimator; only useful if it keeps state across frames")(
+        "stride", po::value<size_t>()->default_value(1),
+        "video: only analyse one frame every N frames (the others are skipped without being decoded, when possible)")(
+        "rate", po::value<double>(),
+        "video: analyse the frames at that rate (in Hz), instead of every frame")(
+        "detection-threshold", po::value<float>()->default_value(0),
+        "minimum detection confidence of the faces: raise it (eg 0.5) to skip marginal detections, lower it to find more faces")(
+        "quality", po::value<string>(),
+        "skip (or only flag) the blurry, tiny, under- or over-exposed faces before fitting their features: skip or flag")(
+        "min-sharpness", po::value<double>(),
+        "with --quality, minimum sharpness of a face (variance of its Laplacian, default 20)")(
+        "tile-size", po::value<int>(),
+        "image/camera: detect the faces on tiles of that size (in pixels), in parallel; for very large frames")(
+        "tile-overlap", po::value<int>()->default_value(160),
+        "image/camera: overlap between the tiles, in pixels: larger faces might be missed")(
+        "budget", po::value<double>(),
+        "image/camera: time budget per frame, in milliseconds: the faces that do not fit in are extrapolated from the previous frame, or deferred to the next one")(
+        "face-priority", po::value<string>()->default_value("largest"),
+        "with --budget, the faces processed first: largest, tracked (already in the previous frame) or centered")(
+        "publish", po::value<string>(),
+        "camera: also publish the results of the last frame in that shared memory segment (eg /gazr-results), for other local processes");
 
     po::variables_map vm;
     po::store(
@@ -56,11 +89,62 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    if (vm.count("image") == 0) {
+    if (vm.count("image") == 0 && vm.count("video") == 0) {
         use_camera = true;
     }
 
+    ResultWriter::Format format;
+    if (!ResultWriter::parseFormat(vm["format"].as<string>(), format)) {
+        cerr << "Unknown output format " << vm["format"].as<string>() << endl;
+        return 1;
+    }
+
+    ResultWriter writer(vm["output"].as<string>(), format);
+    if (!writer.isOpen()) {
+        cerr << "Couldn't open " << vm["output"].as<string>() << endl;
+        return 1;
+    }
+
     auto estimator = HeadPoseEstimation(vm["model"].as<string>());
+    estimator.detectionThreshold = vm["detection-threshold"].as<float>();
+
+    if (vm.count("quality")) {
+        const auto policy = vm["quality"].as<string>();
+        if (policy == "skip") estimator.qualityPolicy = HeadPoseEstimation::QUALITY_SKIP;
+        else if (policy == "flag") estimator.qualityPolicy = HeadPoseEstimation::QUALITY_FLAG;
+        else {
+            cerr << "Unknown quality policy " << policy << endl;
+            return 1;
+        }
+        if (vm.count("min-sharpness")) {
+            estimator.qualityThresholds.min_sharpness = vm["min-sharpness"].as<double>();
+        }
+    }
+
+    if (vm.count("video")) {
+        VideoCapture video_in(vm["video"].as<string>());
+        if (!video_in.isOpened()) {
+            cerr << "Couldn't open video file" << endl;
+            return 1;
+        }
+        estimator.focalLength = 500;
+
+        OfflineVideoPipeline pipeline(estimator,
+                                      max<size_t>(vm["threads"].as<size_t>(), 1),
+                                      vm["chunk-size"].as<size_t>(),
+                                      vm["overlap"].as<size_t>());
+        pipeline.stride = vm.count("rate") ? VideoSampler::strideForRate(video_in, vm["rate"].as<double>())
+                                           : vm["stride"].as<size_t>();
+
+        auto fps = video_in.get(cv::CAP_PROP_FPS);
+
+        // in frame order
+        pipeline.process(video_in, [&writer, fps](const FrameResult& result) {
+            writer.write(result.frame_idx, fps > 0 ? result.frame_idx / fps : 0, result.poses,
+                         std::vector<uint32_t>(), "", result.features);
+        });
+        return 0;
+    }
 
     VideoCapture video_in;
 
@@ -94,48 +178,67 @@ int main(int argc, char **argv) {
         estimator.focalLength = 85.0 / 22.3 * frame.size().width;
     }
 
+    if (vm.count("budget")) {
+        estimator.timeBudget = vm["budget"].as<double>() / 1000;
+
+        const auto priority = vm["face-priority"].as<string>();
+        if (priority == "largest") estimator.facePriority = HeadPoseEstimation::LARGEST_FIRST;
+        else if (priority == "tracked") estimator.facePriority = HeadPoseEstimation::TRACKED_FIRST;
+        else if (priority == "centered") estimator.facePriority = HeadPoseEstimation::CENTERED_FIRST;
+        else {
+            cerr << "Unknown face priority " << priority << endl;
+            return 1;
+        }
+    }
+
+    std::unique_ptr<TiledDetector> tiled_detector;
+    if (vm.count("tile-size")) {
+        tiled_detector.reset(new TiledDetector(estimator,
+                                               max<size_t>(vm["threads"].as<size_t>(), 1),
+                                               vm["tile-size"].as<int>(),
+                                               vm["tile-overlap"].as<int>()));
+    }
+
+    std::unique_ptr<ResultPublisher> publisher;
+    if (use_camera && vm.count("publish")) {
+        publisher.reset(new ResultPublisher(vm["publish"].as<string>()));
+        if (!publisher->isOpen()) {
+            cerr << "Couldn't create the shared memory segment " << vm["publish"].as<string>() << endl;
+            return 1;
+        }
+    }
+
+    auto t_start = getTickCount();
+    uint64_t frame_idx = 0;
+
     while (true) {
         if (use_camera) {
             auto ok = video_in.read(frame);
             if (!ok) break;
         }
 
-        auto all_features = estimator.update(frame);
+        std::vector<std::vector<Point>> all_features;
+        if (tiled_detector) {
+            // the time budget includes the detection, as with update()
+            const auto start = HeadPoseEstimation::Clock::now();
+            all_features = estimator.fitFaces(frame, tiled_detector->detect(frame), std::vector<double>(), start);
+        }
+        else {
+            all_features = estimator.update(frame);
+        }
 
         auto poses = estimator.poses();
 
-        int i = 0;
-        cout << "{";
-
-        for (auto pose : poses) {
-            pose = pose.inv();
-
-            double raw_yaw, raw_pitch, raw_roll;
-            tf::Matrix3x3 mrot(pose(0, 0), pose(0, 1), pose(0, 2), pose(1, 0),
-                               pose(1, 1), pose(1, 2), pose(2, 0), pose(2, 1),
-                               pose(2, 2));
-            mrot.getRPY(raw_roll, raw_pitch, raw_yaw);
-
-            raw_roll = raw_roll - M_PI / 2;
-            raw_yaw = raw_yaw + M_PI / 2;
-
-            double yaw, pitch, roll;
-
-            roll = raw_pitch;
-            yaw = raw_yaw;
-            pitch = -raw_roll;
-
-            cout << "\"face_" << i << "\":";
-            cout << setprecision(1) << fixed << "{\"yaw\":" << todeg(yaw)
-                 << ", \"pitch\":" << todeg(pitch)
-                 << ", \"roll\":" << todeg(roll) << ",";
-            cout << setprecision(4) << fixed << "\"x\":" << pose(0, 3)
-                 << ", \"y\":" << pose(1, 3) << ", \"z\":" << pose(2, 3)
-                 << "},";
-
-            i++;
+        if (use_camera) {
+            auto timestamp = (getTickCount() - t_start) / getTickFrequency();
+            if (publisher) publisher->publish(frame_idx, timestamp, poses);
+            writer.write(frame_idx++, timestamp, poses,
+                         std::vector<uint32_t>(), "", all_features);
+            writer.flush(); // live output: do not wait for the buffer to fill up
+        }
+        else {
+            writer.write(0, 0, poses, std::vector<uint32_t>(), vm["image"].as<string>(), all_features);
         }
-        cout << "}\n" << flush;
 
         if (show_frame) {
             imshow("headpose",
@@ -148,6 +251,8 @@ int main(int argc, char **argv) {
                 break;
             }
         }
+
+        if (!use_camera) break;
     }
 }
 
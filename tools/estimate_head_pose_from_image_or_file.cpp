@@ -7,12 +7,32 @@
 #include <opencv2/highgui/highgui.hpp>
 #endif
 
+#include <boost/program_options.hpp>
 #include <iostream>
+#include <fstream>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <limits>
+#include <algorithm>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdlib>
 
 #include "../src/head_pose_estimation.hpp"
+#include "../src/thread_pool.hpp"
+#include "../src/reduced_decoding.hpp"
+#include "../src/result_writer.hpp"
+#include "../src/result_cache.hpp"
+#include "checkpoint.hpp"
 
 using namespace std;
 using namespace cv;
+namespace po = boost::program_options;
 
 const static size_t NB_TESTS = 100; // number of time the detection is run, to get better average detection duration
 
@@ -30,14 +50,28 @@ std::vector<std::string> readFileToVector(const std::string& filename)
 }
 
 
-void estimate_head_pose_on_frameFileName(const std::string& frameFileName, HeadPoseEstimation estimator, std::vector<head_pose>& prev_poses, bool print_prev_poses)
+Mat read_image(const std::string& frameFileName)
 {
-    cout << "Estimating head pose on " << frameFileName << endl;
 #ifdef OPENCV3
-    Mat img = imread(frameFileName, IMREAD_COLOR);
+    return imread(frameFileName, IMREAD_COLOR);
 #else
-    Mat img = imread(frameFileName, CV_LOAD_IMAGE_COLOR);
+    return imread(frameFileName, CV_LOAD_IMAGE_COLOR);
 #endif
+}
+
+/** Reads the content of a file (eg, a compressed image) in memory.
+ */
+std::vector<uchar> read_file(const std::string& filename)
+{
+    std::ifstream source(filename, std::ios::binary);
+    return std::vector<uchar>((std::istreambuf_iterator<char>(source)),
+                              std::istreambuf_iterator<char>());
+}
+
+void estimate_head_pose_on_frameFileName(const std::string& frameFileName, HeadPoseEstimation estimator, std::vector<head_pose>& prev_poses, bool print_prev_poses)
+{
+    cout << "Estimating head pose on " << frameFileName << endl;
+    Mat img = read_image(frameFileName);
 
     auto nbfaces = 0;
 
@@ -79,21 +113,454 @@ void estimate_head_pose_on_frameFileName(const std::string& frameFileName, HeadP
 }
 
 
+struct DecodedImage {
+    std::vector<uchar> data; // compressed image (only kept for reduced decoding or caching)
+    Mat image;
+    bool cached;
+    CachedResult result;     // if cached
+};
+
+struct ImageResult {
+    size_t index; // in the list of images
+    std::string filename;
+    bool read;
+    std::vector<std::vector<cv::Point>> features;
+    std::vector<head_pose> poses;
+};
+
+/** Headless batch processing: the images are decoded ahead of time by
+ * `nb_decoders` threads, and processed by `nb_threads` estimators in
+ * parallel. At most `prefetch` images are in flight at any time.
+ *
+ * If `reduced_decoding` > 1, the images are decoded `reduced_decoding` times
+ * smaller for face detection, and only decoded again at full resolution if
+ * some faces are too small for their features to be fitted on the reduced
+ * image.
+ *
+ * If `cache` is not null, the images already in the cache are not
+ * decoded nor processed again, and the results of the others are added to
+ * it.
+ *
+ * The results are written with `writer` in input order (the frame index
+ * being the index of the image in the list), from the image `first_index`
+ * to `end_index` (excluded). If `checkpoint` is not null, the progress is
+ * saved periodically, and at the end.
+ */
+void estimate_head_pose_batch(const std::vector<std::string>& frameFileNames,
+                              const HeadPoseEstimation& prototype,
+                              size_t nb_threads, size_t nb_decoders, size_t prefetch,
+                              int reduced_decoding,
+                              ResultCache* cache,
+                              ResultWriter& writer,
+                              size_t first_index = 0,
+                              size_t end_index = std::numeric_limits<size_t>::max(),
+                              Checkpoint* checkpoint = nullptr)
+{
+    // one estimator per worker thread (they share the landmarks model)
+    std::vector<HeadPoseEstimation> estimators(nb_threads, prototype);
+    std::vector<HeadPoseEstimation*> available_estimators;
+    for (auto& estimator : estimators) available_estimators.push_back(&estimator);
+    std::mutex estimators_mutex;
+
+    ThreadPool decoders(nb_decoders);
+    ThreadPool workers(nb_threads);
+
+    std::deque<std::future<ImageResult>> pending;
+    size_t nb_images = 0;
+
+    auto write_next = [&pending, &nb_images, &writer, checkpoint]() {
+        auto result = pending.front().get();
+        pending.pop_front();
+
+        if (result.read) {
+            writer.write(result.index, 0, result.poses, std::vector<uint32_t>(), result.filename, result.features);
+            nb_images++;
+        }
+        else {
+            cerr << "Could not read " << result.filename << endl;
+        }
+
+        if (checkpoint) checkpoint->update(result.index + 1, writer);
+    };
+
+    auto t_start = getTickCount();
+
+    end_index = min(end_index, frameFileNames.size());
+
+    // from now on, the job can always be resumed
+    if (checkpoint) checkpoint->save(first_index, writer);
+
+    for (size_t index = first_index; index < end_index; ++index) {
+        const auto& frameFileName = frameFileNames[index];
+
+        auto image = decoders.submit([frameFileName, reduced_decoding, cache]() {
+            DecodedImage decoded;
+            decoded.cached = false;
+            if (reduced_decoding > 1 || cache) {
+                // the file is read once, both for hashing and decoding
+                decoded.data = read_file(frameFileName);
+                if (decoded.data.empty()) return decoded;
+
+                if (cache && cache->lookup(decoded.data, decoded.result)) {
+                    decoded.cached = true;
+                    return decoded;
+                }
+                decoded.image = reduced_decoding > 1 ? decodeReduced(decoded.data, reduced_decoding)
+                                                     : decodeFull(decoded.data);
+            }
+            else {
+                decoded.image = read_image(frameFileName);
+            }
+            return decoded;
+        }).share();
+
+        pending.push_back(workers.submit([index, frameFileName, image, reduced_decoding, cache, &available_estimators, &estimators_mutex]() {
+            ImageResult result;
+            result.index = index;
+            result.filename = frameFileName;
+
+            const auto& decoded = image.get();
+            if (decoded.cached) {
+                result.read = true;
+                result.features = decoded.result.features;
+                result.poses = decoded.result.poses;
+                return result;
+            }
+
+            result.read = !decoded.image.empty();
+            if (!result.read) return result;
+
+            // there are as many estimators as worker threads: one is always available
+            HeadPoseEstimation* estimator;
+            {
+                std::lock_guard<std::mutex> lock(estimators_mutex);
+                estimator = available_estimators.back();
+                available_estimators.pop_back();
+            }
+
+            // returns the estimator to the pool, even if the processing throws
+            struct EstimatorLease {
+                std::vector<HeadPoseEstimation*>& pool;
+                std::mutex& mutex;
+                HeadPoseEstimation* estimator;
+                ~EstimatorLease() {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    pool.push_back(estimator);
+                }
+            } lease = {available_estimators, estimators_mutex, estimator};
+
+            if (reduced_decoding > 1) {
+                result.features = estimator->update(decoded.image, 1.f / reduced_decoding,
+                                                    [&decoded]() {return decodeFull(decoded.data);});
+            }
+            else {
+                result.features = estimator->update(decoded.image);
+            }
+            result.poses = estimator->poses();
+
+            if (cache) {
+                CachedResult cached;
+                cached.faces = estimator->detections();
+                cached.features = result.features;
+                cached.poses = result.poses;
+                cache->insert(decoded.data, cached);
+            }
+
+            return result;
+        }));
+
+        if (pending.size() >= prefetch) write_next();
+    }
+
+    while (!pending.empty()) write_next();
+    writer.flush();
+    if (checkpoint) checkpoint->save(end_index, writer);
+
+    auto duration = (getTickCount() - t_start) / getTickFrequency();
+    cerr << "Processed " << nb_images << " image(s) in " << duration << "s ("
+         << nb_images / duration << " images/s, " << nb_threads << " threads)" << endl;
+    if (cache) {
+        cerr << "Cache: " << cache->hits << " hit(s), " << cache->misses << " miss(es)" << endl;
+    }
+}
+
+/** Batch processing of the images [begin, end) of the list, with the
+ * options of the command line. The results are written to `output`: if it
+ * is a file, checkpoints are saved next to it, and if `resume` is true, the
+ * processing resumes from the last one. `job` identifies the list of images.
+ *
+ * Returns the exit status of the program.
+ */
+int run_batch(const std::vector<std::string>& frameFileNames, size_t begin, size_t end,
+              const HeadPoseEstimation& estimator,
+              const po::variables_map& vm,
+              ResultWriter::Format format,
+              const std::string& output,
+              bool resume,
+              const std::string& job)
+{
+    auto nb_threads = max<size_t>(vm["threads"].as<size_t>(), 1);
+    auto nb_decoders = max<size_t>(vm["decoders"].as<size_t>(), 1);
+    auto prefetch = vm.count("prefetch") ? max<size_t>(vm["prefetch"].as<size_t>(), 1) : 4 * nb_threads;
+    auto reduced_decoding = vm["reduced-decoding"].as<int>();
+
+    const bool output_to_file = !output.empty() && output != "-";
+
+    // the checkpoint is only valid for the same list of images
+    Checkpoint checkpoint(output + ".checkpoint", job, vm["checkpoint-period"].as<double>());
+
+    size_t first_index = begin;
+    bool resumed = false;
+    if (resume) {
+        uint64_t offset;
+        if (checkpoint.load(first_index, offset)) {
+            if (!ResultWriter::truncate(output, format, offset)) {
+                cerr << output << " does not match its checkpoint: can not resume" << endl;
+                return 1;
+            }
+            resumed = true;
+            cerr << "Resuming at image " << first_index << endl;
+        }
+        else {
+            first_index = begin;
+            cerr << "No checkpoint for " << job << ": starting from image " << begin << endl;
+        }
+    }
+
+    ResultWriter writer(output, format, 1 << 16, resumed);
+    if (!writer.isOpen()) {
+        cerr << "Couldn't open " << output << endl;
+        return 1;
+    }
+
+    std::unique_ptr<ResultCache> cache;
+    if (vm.count("cache")) {
+        // everything the results depend on: model, parameters and version of gazr
+        uint64_t fingerprint;
+        if (!fileHash(vm["model"].as<string>(), fingerprint)) {
+            cerr << "Couldn't read " << vm["model"].as<string>() << endl;
+            return 1;
+        }
+        const std::string version = STR(GAZR_VERSION);
+        const std::string fingerprint_version = "2"; // bump when the hashed parameters change
+        const unsigned long min_face_size = 120; // default of update(reduced_image, ...)
+        fingerprint = contentHash(version.data(), version.size(), fingerprint);
+        fingerprint = contentHash(fingerprint_version.data(), fingerprint_version.size(), fingerprint);
+        fingerprint = contentHash(&estimator.focalLength, sizeof(estimator.focalLength), fingerprint);
+        fingerprint = contentHash(&reduced_decoding, sizeof(reduced_decoding), fingerprint);
+        fingerprint = contentHash(&min_face_size, sizeof(min_face_size), fingerprint);
+        fingerprint = contentHash(&estimator.detectionThreshold, sizeof(estimator.detectionThreshold), fingerprint);
+
+        cache.reset(new ResultCache(vm["cache"].as<string>(), fingerprint));
+        if (!cache->isOpen()) {
+            cerr << "Couldn't open the cache in " << vm["cache"].as<string>() << endl;
+            return 1;
+        }
+        cerr << "Cache: " << cache->size() << " image(s) already processed" << endl;
+    }
+
+    estimate_head_pose_batch(frameFileNames, estimator, nb_threads, nb_decoders, prefetch, reduced_decoding, cache.get(),
+                             writer, first_index, end, output_to_file ? &checkpoint : nullptr);
+    return 0;
+}
+
+/** Launcher mode: the list of images is split into `--processes` contiguous
+ * shards, each processed by a worker process with run_batch(). The workers
+ * are forked once the model is loaded: they share its memory (copy-on-write,
+ * and never written) instead of loading it again.
+ *
+ * A worker that crashes (eg, in dlib or OpenCV) does not bring the others
+ * down: it is restarted from its last checkpoint, up to MAX_WORKER_RESTARTS
+ * times. The results of the shards are then merged, in order, into
+ * `--output`.
+ *
+ * Returns the exit status of the program.
+ */
+int run_processes(const std::vector<std::string>& frameFileNames,
+                  const HeadPoseEstimation& estimator,
+                  const po::variables_map& vm,
+                  ResultWriter::Format format,
+                  const std::string& job)
+{
+    const size_t MAX_WORKER_RESTARTS = 2;
+
+    const auto nb_processes = max<size_t>(vm["processes"].as<size_t>(), 1);
+    const auto output = vm["output"].as<string>();
+    const bool resume = vm.count("resume") > 0;
+
+    // the results of the shards are written next to the output, or in a
+    // temporary directory when writing to the standard output
+    std::string shards_prefix;
+    if (output.empty() || output == "-") {
+        char tmp_dir[] = "/tmp/gazr-XXXXXX";
+        if (!mkdtemp(tmp_dir)) {
+            cerr << "Couldn't create a temporary directory" << endl;
+            return 1;
+        }
+        shards_prefix = std::string(tmp_dir) + "/results";
+    }
+    else {
+        shards_prefix = output;
+    }
+
+    struct Shard {
+        size_t begin, end;
+        std::string output;
+        pid_t pid;
+        size_t nb_restarts;
+    };
+
+    std::vector<Shard> shards;
+    for (size_t i = 0; i < nb_processes; ++i) {
+        Shard shard;
+        shard.begin = frameFileNames.size() * i / nb_processes;
+        shard.end = frameFileNames.size() * (i + 1) / nb_processes;
+        shard.output = shards_prefix + ".shard" + to_string(i);
+        shard.pid = -1;
+        shard.nb_restarts = 0;
+        shards.push_back(shard);
+
+        // the result stores are appended to: do not mix with a previous run
+        if (!resume && (format == ResultWriter::COLUMNAR || format == ResultWriter::COLUMNAR_LANDMARKS)) {
+            ResultWriter::truncate(shard.output, format, 0);
+        }
+    }
+
+    auto launch = [&](Shard& shard, bool resume_shard) {
+        cout.flush();
+        cerr.flush();
+
+        shard.pid = fork();
+        if (shard.pid == 0) {
+            const auto shard_job = job + " [" + to_string(shard.begin) + ", " + to_string(shard.end) + ")";
+            _exit(run_batch(frameFileNames, shard.begin, shard.end, estimator, vm, format,
+                            shard.output, resume_shard, shard_job));
+        }
+        return shard.pid > 0;
+    };
+
+    auto t_start = getTickCount();
+
+    for (auto& shard : shards) {
+        if (!launch(shard, resume)) {
+            cerr << "Couldn't start a worker process" << endl;
+            return 1;
+        }
+    }
+
+    size_t nb_running = shards.size();
+    bool failed = false;
+
+    while (nb_running > 0) {
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0) break;
+
+        auto shard = std::find_if(shards.begin(), shards.end(), [pid](const Shard& shard) {return shard.pid == pid;});
+        if (shard == shards.end()) continue;
+
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+            nb_running--;
+            continue;
+        }
+
+        cerr << "Worker for images [" << shard->begin << ", " << shard->end << ") "
+             << (WIFSIGNALED(status) ? "crashed (signal " + to_string(WTERMSIG(status)) + ")"
+                                     : "failed (status " + to_string(WEXITSTATUS(status)) + ")");
+
+        if (shard->nb_restarts < MAX_WORKER_RESTARTS && launch(*shard, true)) {
+            shard->nb_restarts++;
+            cerr << ": restarting it from its last checkpoint" << endl;
+        }
+        else {
+            cerr << ": giving up" << endl;
+            failed = true;
+            nb_running--;
+        }
+    }
+
+    if (failed) {
+        cerr << "Some images were not processed. The results of the workers are kept in "
+             << shards_prefix << ".shard*: run the same command with --resume to finish the job." << endl;
+        return 1;
+    }
+
+    ResultWriter writer(output, format);
+    if (!writer.isOpen()) {
+        cerr << "Couldn't open " << output << endl;
+        return 1;
+    }
+
+    for (const auto& shard : shards) {
+        if (!writer.merge(shard.output)) {
+            cerr << "Couldn't merge the results of " << shard.output << endl;
+            return 1;
+        }
+    }
+    writer.flush();
+
+    for (const auto& shard : shards) {
+        ResultWriter::remove(shard.output, format);
+        std::remove((shard.output + ".checkpoint").c_str());
+    }
+    if (output.empty() || output == "-") {
+        rmdir(shards_prefix.substr(0, shards_prefix.rfind('/')).c_str());
+    }
+
+    auto duration = (getTickCount() - t_start) / getTickFrequency();
+    cerr << "Processed " << frameFileNames.size() << " image(s) in " << duration << "s ("
+         << frameFileNames.size() / duration << " images/s, " << nb_processes << " processes x "
+         << max<size_t>(vm["threads"].as<size_t>(), 1) << " threads)" << endl;
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
     Mat frame;
 
-    if(argc < 3) {
+    po::positional_options_description p;
+    p.add("model", 1);
+    p.add("input", 1);
+
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help,h", "produce help message")
+        ("version,v", "shows version and exits")
+        ("batch,b", "headless batch mode: process each image once, in parallel, and write the results in input order")
+        ("threads,j", po::value<size_t>()->default_value(std::thread::hardware_concurrency()), "number of parallel estimators (batch mode)")
+        ("decoders", po::value<size_t>()->default_value(2), "number of image decoding threads (batch mode)")
+        ("prefetch", po::value<size_t>(), "maximum number of images in flight (batch mode, default: 4 x threads)")
+        ("output,o", po::value<string>()->default_value("-"), "file the results are written to (batch mode, default: standard output)")
+        ("format", po::value<string>()->default_value("json"), "format of the results: json (one JSON object per image and per line), binary, columnar or columnar-landmarks (memory-mappable result store in the --output directory) (batch mode)")
+        ("reduced-decoding", po::value<int>()->default_value(1), "decode the images 2, 4 or 8 times smaller for face detection (batch mode; fast for JPEG)")
+        ("resume", "resume an interrupted run from its last checkpoint, saved next to the --output file (batch mode)")
+        ("checkpoint-period", po::value<double>()->default_value(60), "save a checkpoint every N seconds, when the results are written to a file (batch mode)")
+        ("processes,p", po::value<size_t>(), "launcher mode: split the images across N worker processes (each with --threads estimators), and merge their results (batch mode)")
+        ("cache", po::value<string>(), "directory of a cache of the results, keyed by image content: images already processed with the same model and parameters are skipped (batch mode)")
+        ("detection-threshold", po::value<float>()->default_value(0), "minimum detection confidence of the faces: raise it (eg 0.5) to skip marginal detections, lower it to find more faces")
+        ("model", po::value<string>(), "dlib's trained face model")
+        ("input", po::value<string>(), "image (.jpg, .png) or .txt file containing a list of images in individual lines");
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(desc).positional(p).run(), vm);
+    po::notify(vm);
+
+    if (vm.count("version")) {
+        cout << argv[0] << " " << STR(GAZR_VERSION) << "\n";
+        return 0;
+    }
+
+    if (vm.count("help") || vm.count("model") == 0 || vm.count("input") == 0) {
         cerr << argv[0] << " " << STR(GAZR_VERSION) << "\n\nUsage: " 
              << endl << argv[0] << " model.dat frame.{jpg|png}\n\nOR\n\n"
-             << endl << argv[0] << " model.dat filenames.txt" << endl;
+             << endl << argv[0] << " [--batch] model.dat filenames.txt\n\n" << desc << endl;
 #ifdef HEAD_POSE_ESTIMATION_DEBUG
         cerr <<  "Output: a new frame 'head_pose_<frame>.png'" << endl;
 #endif
         return 1;
     }
 
-    std::string fileName = argv[2];
+    std::string fileName = vm["input"].as<string>();
 
     if (fileName.find(".jpg") == std::string::npos and
         fileName.find(".png") == std::string::npos and
@@ -102,8 +569,47 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    auto estimator = HeadPoseEstimation(argv[1]);
+    auto estimator = HeadPoseEstimation(vm["model"].as<string>());
     estimator.focalLength = 500;
+    estimator.detectionThreshold = vm["detection-threshold"].as<float>();
+
+    if (vm.count("batch")) {
+        std::vector<std::string> frameFileNames;
+        if (fileName.find(".txt") == std::string::npos) {
+            frameFileNames.push_back(fileName);
+        }
+        else {
+            for (auto frameFileName : readFileToVector(fileName)) {
+                if (frameFileName.find("jpg") != std::string::npos or frameFileName.find("png") != std::string::npos) {
+                    frameFileNames.push_back(frameFileName);
+                }
+            }
+        }
+
+        auto reduced_decoding = vm["reduced-decoding"].as<int>();
+        if (reduced_decoding != 1 && reduced_decoding != 2 && reduced_decoding != 4 && reduced_decoding != 8) {
+            cerr << "--reduced-decoding must be 1, 2, 4 or 8" << endl;
+            return 1;
+        }
+
+        ResultWriter::Format format;
+        if (!ResultWriter::parseFormat(vm["format"].as<string>(), format)) {
+            cerr << "Unknown output format " << vm["format"].as<string>() << endl;
+            return 1;
+        }
+
+        if (vm.count("resume") && (vm["output"].as<string>().empty() || vm["output"].as<string>() == "-")) {
+            cerr << "--resume requires the results to be written to a file (--output)" << endl;
+            return 1;
+        }
+
+        if (vm.count("processes")) {
+            return run_processes(frameFileNames, estimator, vm, format, fileName);
+        }
+
+        return run_batch(frameFileNames, 0, frameFileNames.size(), estimator, vm, format,
+                         vm["output"].as<string>(), vm.count("resume") > 0, fileName);
+    }
 
     cout << "Running " << NB_TESTS << " loops to get a good performance estimate..." << endl;
 #ifdef HEAD_POSE_ESTIMATION_DEBUG
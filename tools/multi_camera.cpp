@@ -0,0 +1,196 @@
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <csignal>
+#include <opencv2/opencv.hpp>
+
+#include "../src/head_pose_estimation.hpp"
+#include "../src/multi_stream_runtime.hpp"
+#include "../src/result_writer.hpp"
+#ifdef HEAD_POSE_ESTIMATION_CNN_DETECTOR
+#include "../src/cnn_face_detector.hpp"
+#endif
+
+#define STR_EXPAND(tok) #tok
+#define STR(tok) STR_EXPAND(tok)
+
+using namespace std;
+using namespace cv;
+namespace po = boost::program_options;
+
+static std::atomic<bool> stop(false);
+
+static void onSignal(int)
+{
+    stop = true;
+}
+
+/** Opens a camera by index ("0") or a video file/stream by name.
+ */
+static bool openSource(const string& source, VideoCapture& capture)
+{
+    if (!source.empty() && source.find_first_not_of("0123456789") == string::npos) {
+        return capture.open(stoi(source));
+    }
+    return capture.open(source);
+}
+
+int main(int argc, char **argv)
+{
+    po::positional_options_description p;
+    p.add("sources", -1);
+
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help,h", "produce help message")
+        ("version,v", "shows version and exits")
+        ("model", po::value<string>(), "dlib's trained face model")
+        ("sources", po::value<vector<string>>()->multitoken(), "cameras (by index, eg 0) or video streams to process")
+        ("threads,j", po::value<size_t>()->default_value(std::thread::hardware_concurrency()), "number of estimators, shared by all the sources")
+        ("priority", po::value<vector<int>>()->multitoken(), "priority of each source (default: 0); the frames of the highest priority sources are processed first")
+        ("deadline", po::value<double>()->default_value(0), "drop the frames not processed within that many milliseconds of their capture (0: never)")
+        ("queue-size", po::value<size_t>()->default_value(2), "frames waiting to be processed, per source")
+        ("drop", po::value<string>()->default_value("oldest"), "when the queue of a source is full, drop its oldest or newest frame")
+        ("focal-length", po::value<float>()->default_value(500), "focal length of the cameras, in pixels")
+        ("detection-threshold", po::value<float>()->default_value(0), "minimum detection confidence of the faces: raise it (eg 0.5) to skip marginal detections")
+        ("skip-poor-faces", "skip the blurry, tiny, under- or over-exposed faces before fitting their features")
+        ("min-sharpness", po::value<double>(), "with --skip-poor-faces, minimum sharpness of a face (variance of its Laplacian, default 20)")
+        ("output,o", po::value<string>()->default_value("-"), "file the results are written to (default: standard output), in JSON (one object per frame and per line, with the source)")
+        ("stats-period", po::value<double>()->default_value(5), "print the throughput of each source every that many seconds (0: never)")
+#ifdef HEAD_POSE_ESTIMATION_CNN_DETECTOR
+        ("cnn-model", po::value<string>(), "detect the faces with dlib's CNN detector (eg mmod_human_face_detector.dat), on batches of frames of several sources")
+        ("batch-size", po::value<size_t>(), "CNN: maximum number of frames per batch (default: the number of threads)")
+        ("batch-wait", po::value<double>()->default_value(10), "CNN: maximum time a frame waits for its batch to fill up, in milliseconds")
+#endif
+        ;
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(desc).positional(p).run(), vm);
+    po::notify(vm);
+
+    if (vm.count("version")) {
+        cout << argv[0] << " " << STR(GAZR_VERSION) << "\n";
+        return 0;
+    }
+
+    if (vm.count("help") || vm.count("model") == 0 || vm.count("sources") == 0) {
+        cerr << argv[0] << " " << STR(GAZR_VERSION) << "\n\nUsage: "
+             << endl << argv[0] << " [options] --model model.dat source1 source2...\n\n"
+             << "Estimates the head poses of all the given cameras, with a single model\n"
+             << "and a single pool of estimators.\n\n" << desc << endl;
+        return 1;
+    }
+
+    AsyncHeadPoseEstimation::DropPolicy drop_policy;
+    if (!AsyncHeadPoseEstimation::parseDropPolicy(vm["drop"].as<string>(), drop_policy)) {
+        cerr << "Unknown drop policy " << vm["drop"].as<string>() << endl;
+        return 1;
+    }
+
+    const auto sources = vm["sources"].as<vector<string>>();
+    const auto priorities = vm.count("priority") ? vm["priority"].as<vector<int>>() : vector<int>();
+
+    vector<VideoCapture> captures(sources.size());
+    for (size_t i = 0; i < sources.size(); ++i) {
+        if (!openSource(sources[i], captures[i])) {
+            cerr << "Couldn't open " << sources[i] << endl;
+            return 1;
+        }
+    }
+
+    ResultWriter writer(vm["output"].as<string>());
+    if (!writer.isOpen()) {
+        cerr << "Couldn't open " << vm["output"].as<string>() << endl;
+        return 1;
+    }
+    std::mutex writer_mutex;
+
+    auto estimator = HeadPoseEstimation(vm["model"].as<string>());
+    estimator.focalLength = vm["focal-length"].as<float>();
+    estimator.detectionThreshold = vm["detection-threshold"].as<float>();
+    if (vm.count("skip-poor-faces")) {
+        estimator.qualityPolicy = HeadPoseEstimation::QUALITY_SKIP;
+        if (vm.count("min-sharpness")) {
+            estimator.qualityThresholds.min_sharpness = vm["min-sharpness"].as<double>();
+        }
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    {
+        MultiStreamRuntime runtime(estimator, max<size_t>(vm["threads"].as<size_t>(), 1));
+
+        shared_ptr<BatchedDetector> batched_detector;
+#ifdef HEAD_POSE_ESTIMATION_CNN_DETECTOR
+        if (vm.count("cnn-model")) {
+            auto cnn_detector = make_shared<CnnFaceDetector>(vm["cnn-model"].as<string>());
+            batched_detector = make_shared<BatchedDetector>(
+                    [cnn_detector](const vector<Mat>& images) {return cnn_detector->detect(images);},
+                    vm.count("batch-size") ? vm["batch-size"].as<size_t>() : runtime.nbWorkers(),
+                    vm["batch-wait"].as<double>() / 1000);
+            runtime.setDetector(batched_detector);
+        }
+#endif
+
+        for (size_t i = 0; i < sources.size(); ++i) {
+            StreamConfig config;
+            config.priority = i < priorities.size() ? priorities[i] : 0;
+            config.deadline = vm["deadline"].as<double>() / 1000;
+            config.queue_size = vm["queue-size"].as<size_t>();
+            config.drop_policy = drop_policy;
+
+            runtime.addStream(config, [&writer, &writer_mutex, &sources](size_t stream, const AsyncResult& result) {
+                if (result.dropped) return;
+                lock_guard<std::mutex> lock(writer_mutex);
+                writer.write(result.frame_idx, result.timestamp, result.poses, vector<uint32_t>(), sources[stream]);
+                writer.flush(); // live output: do not wait for the buffer to fill up
+            });
+        }
+
+        // one capture thread per source: capturing never waits for the estimation
+        const auto t_start = getTickCount();
+        std::atomic<size_t> nb_running(sources.size());
+        vector<thread> capture_threads;
+        for (size_t i = 0; i < sources.size(); ++i) {
+            capture_threads.emplace_back([&runtime, &captures, &nb_running, i, t_start] {
+                Mat frame;
+                while (!stop && captures[i].read(frame)) {
+                    runtime.submit(i, frame, (getTickCount() - t_start) / getTickFrequency());
+                }
+                --nb_running;
+            });
+        }
+
+        const auto stats_period = vm["stats-period"].as<double>();
+        auto last_stats = getTickCount();
+        while (!stop && nb_running > 0) {
+            this_thread::sleep_for(chrono::milliseconds(100));
+
+            if (stats_period > 0 && (getTickCount() - last_stats) / getTickFrequency() > stats_period) {
+                last_stats = getTickCount();
+                for (size_t i = 0; i < sources.size(); ++i) {
+                    auto stats = runtime.stats(i);
+                    cerr << sources[i] << ": " << fixed << setprecision(1) << stats.fps << " fps, "
+                         << setprecision(0) << stats.latency * 1000 << " ms latency, "
+                         << stats.dropped << " dropped, " << stats.expired << " expired" << endl;
+                }
+                if (batched_detector) {
+                    auto stats = batched_detector->stats();
+                    cerr << "detection: " << setprecision(1) << stats.batch_size << " frames per batch, "
+                         << setprecision(0) << stats.batch_time * 1000 << " ms per batch, "
+                         << stats.wait * 1000 << " ms wait, "
+                         << setprecision(1) << stats.images_per_second << " frames/s" << endl;
+                }
+            }
+        }
+
+        stop = true;
+        for (auto& capture_thread : capture_threads) capture_thread.join();
+    }
+
+    return 0;
+}
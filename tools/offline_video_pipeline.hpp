@@ -0,0 +1,276 @@
+#ifndef __OFFLINE_VIDEO_PIPELINE
+#define __OFFLINE_VIDEO_PIPELINE
+
+#include <vector>
+#include <deque>
+#include <future>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <algorithm>
+#include <exception>
+
+#include <opencv2/core/core.hpp>
+#ifdef OPENCV3
+#include <opencv2/videoio.hpp>
+#else
+#include <opencv2/highgui/highgui.hpp>
+#endif
+
+#include "../src/head_pose_estimation.hpp"
+#include "../src/thread_pool.hpp"
+#include "video_sampler.hpp"
+
+struct FrameResult {
+    size_t frame_idx;
+    cv::Mat frame; // only set if OfflineVideoPipeline::keep_frames is true
+    std::vector<std::vector<cv::Point>> features;
+    std::vector<head_pose> poses;
+};
+
+/** Processes a video file faster than real-time, using several cores.
+ *
+ * The video is decoded ahead on a dedicated thread, and split into chunks of
+ * `chunk_size` consecutive frames. Each chunk is processed by its own
+ * estimator (a copy of the prototype) on a pool of `nb_threads` threads.
+ *
+ * Within a chunk, frames are processed in order. If the estimator keeps
+ * some state from one frame to the next, each chunk can start with the last
+ * `overlap` frames of the previous one to warm it up (their results are
+ * discarded). HeadPoseEstimation::update() does not (unless a time budget
+ * is set), hence no overlap by default: it would only waste CPU.
+ *
+ * The decoded frames waiting to be processed are bounded by `max_memory`
+ * bytes: the decoding waits for chunks to be processed, and the chunks are
+ * made smaller than `chunk_size` if needed to keep all the threads busy.
+ *
+ * Only one frame every `stride` frames is analysed (see VideoSampler),
+ * starting at `first_frame_idx` (eg, to resume an interrupted run).
+ *
+ * The results are returned in frame order.
+ */
+class OfflineVideoPipeline {
+
+public:
+
+    OfflineVideoPipeline(const HeadPoseEstimation& prototype,
+                         size_t nb_threads,
+                         size_t chunk_size = 100,
+                         size_t overlap = 0) :
+        keep_frames(false),
+        annotate_frames(false),
+        stride(1),
+        seek_min_stride(250),
+        first_frame_idx(0),
+        max_memory(size_t(2) << 30),
+        prototype(prototype),
+        workers(nb_threads),
+        chunk_size(std::max<size_t>(chunk_size, 1)),
+        overlap(overlap)
+    {}
+
+    /** Processes the whole video, and calls `output` for every frame, in
+     * order, from the calling thread. Returns the number of processed frames.
+     */
+    size_t process(cv::VideoCapture& video, const std::function<void(const FrameResult&)>& output)
+    {
+        struct Chunk {
+            std::future<std::vector<FrameResult>> results;
+            size_t nb_frames; // decoded frames, including the overlap
+        };
+
+        std::deque<Chunk> chunks;
+        size_t frames_in_flight = 0; // of the submitted chunks not yet output
+        bool decoding_done = false;
+        bool stop = false;
+        std::exception_ptr decoding_error;
+        std::mutex mutex;
+        std::condition_variable chunk_submitted, chunk_consumed;
+
+        std::thread decoder([&]() {
+            try {
+                decode(video, chunks, frames_in_flight, stop, mutex, chunk_submitted, chunk_consumed);
+            }
+            catch (...) {
+                decoding_error = std::current_exception();
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                decoding_done = true;
+            }
+            chunk_submitted.notify_one();
+        });
+
+        size_t nb_frames = 0;
+
+        try {
+            while (true) {
+                Chunk chunk;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    chunk_submitted.wait(lock, [&]() {return decoding_done || !chunks.empty();});
+                    if (chunks.empty()) break;
+                    chunk = std::move(chunks.front());
+                    chunks.pop_front();
+                }
+
+                for (const auto& result : chunk.results.get()) {
+                    output(result);
+                    nb_frames++;
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    frames_in_flight -= chunk.nb_frames;
+                }
+                chunk_consumed.notify_one();
+            }
+        }
+        catch (...) {
+            // the decoder might be waiting for room
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+            chunk_consumed.notify_one();
+            decoder.join();
+            throw;
+        }
+
+        decoder.join();
+        if (decoding_error) std::rethrow_exception(decoding_error);
+        return nb_frames;
+    }
+
+    bool keep_frames;
+    bool annotate_frames; // if true, the kept frames have the detections drawn in
+
+    size_t stride;          // only analyse one frame every `stride` frames
+    size_t seek_min_stride; // seek instead of grabbing the skipped frames above that stride
+    size_t first_frame_idx; // frames before are not processed (except to warm up the estimator)
+    size_t max_memory;      // bytes of decoded frames waiting to be processed (2 GB by default)
+
+private:
+
+    /** Decodes the video into chunks, submitted to the workers as long as
+     * the frames in flight fit in `max_memory` (or none is in flight), until
+     * the end of the video or `stop`.
+     */
+    template<typename Chunks>
+    void decode(cv::VideoCapture& video,
+                Chunks& chunks,
+                size_t& frames_in_flight,
+                const bool& stop,
+                std::mutex& mutex,
+                std::condition_variable& chunk_submitted,
+                std::condition_variable& chunk_consumed)
+    {
+        VideoSampler sampler(video, stride, seek_min_stride);
+
+        std::vector<cv::Mat> frames;     // frames of the current chunk, including the overlap
+        std::vector<size_t> frame_idxs;  // their index in the video
+        size_t nb_warmup_frames = 0;
+
+        size_t max_frames = 0;   // in flight, once the size of the frames is known
+        size_t chunk_frames = 0; // new frames per chunk
+        size_t reserved = 0;     // frames reserved for the current chunk
+
+        // when starting in the middle of the video, the first chunk is
+        // warmed up like the others
+        bool ok = first_frame_idx == 0 ||
+                  sampler.skipTo(first_frame_idx - std::min(first_frame_idx, overlap * stride));
+
+        while (ok) {
+            cv::Mat frame; // a new buffer for every frame: the chunks keep references to them
+            size_t frame_idx;
+            ok = sampler.read(frame, frame_idx);
+
+            if (ok && max_frames == 0) {
+                const size_t frame_size = std::max<size_t>(frame.total() * frame.elemSize(), 1);
+                max_frames = std::max<size_t>(max_memory / frame_size, 1);
+                // enough chunks for all the workers, and one being decoded
+                chunk_frames = std::max<size_t>(std::min(chunk_size, max_frames / (workers.size() + 1)), 1);
+                if (chunk_frames + overlap > max_frames) chunk_frames = 1;
+            }
+
+            if (ok && reserved == 0) {
+                // room for the whole chunk, before decoding it
+                reserved = chunk_frames + overlap;
+                std::unique_lock<std::mutex> lock(mutex);
+                chunk_consumed.wait(lock, [&]() {
+                    return stop || frames_in_flight == 0 || frames_in_flight + reserved <= max_frames;
+                });
+                if (stop) return;
+                frames_in_flight += reserved;
+            }
+
+            if (ok) {
+                frames.push_back(frame);
+                frame_idxs.push_back(frame_idx);
+                if (frame_idx < first_frame_idx) nb_warmup_frames++;
+            }
+
+            if (frames.size() - nb_warmup_frames == chunk_frames ||
+                (!ok && frames.size() > nb_warmup_frames)) {
+
+                auto results = workers.submit([this, frames, frame_idxs, nb_warmup_frames]() {
+                    return processChunk(frames, frame_idxs, nb_warmup_frames);
+                });
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    chunks.push_back({std::move(results), reserved});
+                }
+                chunk_submitted.notify_one();
+                reserved = 0;
+
+                nb_warmup_frames = std::min(overlap, frames.size());
+                frames.erase(frames.begin(), frames.end() - nb_warmup_frames);
+                frame_idxs.erase(frame_idxs.begin(), frame_idxs.end() - nb_warmup_frames);
+            }
+        }
+
+        if (reserved > 0) { // only warm-up frames left: nothing submitted
+            std::lock_guard<std::mutex> lock(mutex);
+            frames_in_flight -= reserved;
+        }
+    }
+
+    std::vector<FrameResult> processChunk(const std::vector<cv::Mat>& frames,
+                                          const std::vector<size_t>& frame_idxs,
+                                          size_t nb_warmup_frames) const
+    {
+        // copies of the prototype share its landmarks model: this is cheap
+        HeadPoseEstimation estimator(prototype);
+
+        std::vector<FrameResult> results;
+
+        for (size_t i = 0; i < frames.size(); ++i) {
+            auto features = estimator.update(frames[i]);
+            if (i < nb_warmup_frames) continue;
+
+            FrameResult result;
+            result.frame_idx = frame_idxs[i];
+            result.features = features;
+            result.poses = estimator.poses();
+            if (keep_frames) {
+                result.frame = annotate_frames ? estimator.drawDetections(frames[i], features, result.poses)
+                                               : frames[i];
+            }
+            results.push_back(result);
+        }
+
+        return results;
+    }
+
+    const HeadPoseEstimation prototype;
+
+    ThreadPool workers;
+
+    size_t chunk_size;
+    size_t overlap;
+};
+
+#endif // __OFFLINE_VIDEO_PIPELINE
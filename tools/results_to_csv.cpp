@@ -0,0 +1,83 @@
+#include <boost/program_options.hpp>
+#include <cstdio>
+#include <iostream>
+
+#include "../src/result_store.hpp"
+
+#define STR_EXPAND(tok) #tok
+#define STR(tok) STR_EXPAND(tok)
+
+using namespace std;
+namespace po = boost::program_options;
+
+int main(int argc, char **argv) {
+
+    po::positional_options_description p;
+    p.add("store", 1);
+
+    po::options_description desc("Allowed options");
+    desc.add_options()("help,h", "produces help message")(
+        "version,v", "shows version and exits")(
+        "landmarks,l", "also exports the facial features, if present in the store")(
+        "store", po::value<string>(), "directory of the result store (as written with --format columnar)");
+
+    po::variables_map vm;
+    po::store(
+        po::command_line_parser(argc, argv).options(desc).positional(p).run(),
+        vm);
+    po::notify(vm);
+
+    if (vm.count("help") || vm.count("store") == 0) {
+        cout << argv[0] << " " << STR(GAZR_VERSION) << "\n\n"
+             << "Converts a result store to CSV (on the standard output)\n\n" << desc << "\n";
+        return 1;
+    }
+
+    if (vm.count("version")) {
+        cout << argv[0] << " " << STR(GAZR_VERSION) << "\n";
+        return 0;
+    }
+
+    ResultStoreReader store;
+    if (!store.open(vm["store"].as<string>())) {
+        cerr << "Couldn't open the result store " << vm["store"].as<string>() << endl;
+        return 1;
+    }
+
+    const bool with_landmarks = vm.count("landmarks") && store.hasLandmarks();
+
+    // large output buffer: the store can have millions of rows
+    static char buffer[1 << 20];
+    setvbuf(stdout, buffer, _IOFBF, sizeof(buffer));
+
+    printf("frame,timestamp,track_id,x,y,z,qx,qy,qz,qw");
+    if (with_landmarks) {
+        for (size_t i = 0; i < RESULT_STORE_NB_LANDMARKS; ++i) printf(",l%zu_x,l%zu_y", i, i);
+    }
+    printf("\n");
+
+    const auto frame_idx = store.frameIdx();
+    const auto timestamps = store.timestamps();
+    const auto track_ids = store.trackIds();
+    const auto translations = store.translations();
+    const auto rotations = store.rotations();
+    const auto landmarks = store.landmarks();
+
+    for (size_t row = 0; row < store.size(); ++row) {
+        const float* t = translations + 3 * row;
+        const float* q = rotations + 4 * row;
+
+        printf("%llu,%.3f,%u,%.4f,%.4f,%.4f,%.5f,%.5f,%.5f,%.5f",
+               (unsigned long long) frame_idx[row], timestamps[row], track_ids[row],
+               t[0], t[1], t[2], q[0], q[1], q[2], q[3]);
+
+        if (with_landmarks) {
+            const int16_t* l = landmarks + 2 * RESULT_STORE_NB_LANDMARKS * row;
+            for (size_t i = 0; i < 2 * RESULT_STORE_NB_LANDMARKS; ++i) printf(",%d", l[i]);
+        }
+        printf("\n");
+    }
+
+    fflush(stdout);
+    return 0;
+}
@@ -1,9 +1,13 @@
 #include <boost/program_options.hpp>
 #include <iomanip>
 #include <iostream>
+#include <thread>
 #include <opencv2/highgui/highgui.hpp>
 
 #include "../src/head_pose_estimation.hpp"
+#include "../src/result_writer.hpp"
+#include "offline_video_pipeline.hpp"
+#include "checkpoint.hpp"
 
 #define STR_EXPAND(tok) #tok
 #define STR(tok) STR_EXPAND(tok)
@@ -17,8 +21,6 @@ inline double todeg(double rad) { return rad * 180 / M_PI; }
 int main(int argc, char **argv) {
     Mat frame;
 
-    namedWindow("headpose");
-
     string video_file;
 
     po::positional_options_description p;
@@ -29,7 +31,26 @@ int main(int argc, char **argv) {
         "version,v", "shows version and exits")("model", po::value<string>(),
                                                 "dlib's trained face model")(
         "video", po::value<string>(),
-        "video to process. If omitted, uses the first webcam");
+        "video to process. If omitted, uses the first webcam")(
+        "offline", "headless mode: process the video file as fast as possible, on several cores")(
+        "output,o", po::value<string>(), "offline mode: write the annotated video to this file")(
+        "results", po::value<string>()->default_value("-"),
+        "offline mode: file the results are written to (default: standard output)")(
+        "format", po::value<string>()->default_value("json"),
+        "offline mode: format of the results: json (one JSON object per frame and per line), binary, columnar or columnar-landmarks (memory-mappable result store in the --results directory)")(
+        "resume", "offline mode: resume an interrupted run from its last checkpoint, saved next to the --results file")(
+        "checkpoint-period", po::value<double>()->default_value(60),
+        "offline mode: save a checkpoint every N seconds, when the results are written to a file")(
+        "threads,j", po::value<size_t>()->default_value(std::thread::hardware_concurrency()),
+        "offline mode: number of parallel estimators")(
+        "chunk-size", po::value<size_t>()->default_value(100),
+        "offline mode: number of consecutive frames processed by the same estimator")(
+        "overlap", po::value<size_t>()->default_value(0),
+        "offline mode: number of frames of the previous chunk re-processed to warm up the estimator; only useful if it keeps state across frames")(
+        "stride", po::value<size_t>()->default_value(1),
+        "video: only analyse one frame every N frames (the others are skipped without being decoded, when possible)")(
+        "rate", po::value<double>(),
+        "video: analyse the frames at that rate (in Hz), instead of every frame");
 
     po::variables_map vm;
     po::store(
@@ -76,8 +97,115 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    if (vm.count("offline")) {
+        if (vm.count("video") == 0) {
+            cerr << "The offline mode requires a video file" << endl;
+            return 1;
+        }
+
+        OfflineVideoPipeline pipeline(estimator,
+                                      max<size_t>(vm["threads"].as<size_t>(), 1),
+                                      vm["chunk-size"].as<size_t>(),
+                                      vm["overlap"].as<size_t>());
+        pipeline.stride = vm.count("rate") ? VideoSampler::strideForRate(video_in, vm["rate"].as<double>())
+                                           : vm["stride"].as<size_t>();
+
+        VideoWriter video_out;
+        if (vm.count("output")) {
+            pipeline.keep_frames = true;
+            pipeline.annotate_frames = true;
+            auto fps = video_in.get(cv::CAP_PROP_FPS);
+            video_out.open(vm["output"].as<string>(),
+                           VideoWriter::fourcc('M', 'J', 'P', 'G'),
+                           fps > 0 ? fps : 25,
+                           Size(video_in.get(cv::CAP_PROP_FRAME_WIDTH),
+                                video_in.get(cv::CAP_PROP_FRAME_HEIGHT)));
+            if (!video_out.isOpened()) {
+                cerr << "Couldn't open the output video file" << endl;
+                return 1;
+            }
+        }
+
+        ResultWriter::Format format;
+        if (!ResultWriter::parseFormat(vm["format"].as<string>(), format)) {
+            cerr << "Unknown output format " << vm["format"].as<string>() << endl;
+            return 1;
+        }
+
+        const auto results = vm["results"].as<string>();
+        const bool results_to_file = !results.empty() && results != "-";
+        if (vm.count("resume") && (!results_to_file || vm.count("output"))) {
+            cerr << "--resume requires the results to be written to a file (--results), and no output video" << endl;
+            return 1;
+        }
+
+        // the checkpoint is only valid for the same video, sampled the same way
+        Checkpoint checkpoint(results + ".checkpoint",
+                              vm["video"].as<string>() + " (stride " + to_string(pipeline.stride) + ")",
+                              vm["checkpoint-period"].as<double>());
+
+        bool resumed = false;
+        if (vm.count("resume")) {
+            size_t next_frame_idx;
+            uint64_t offset;
+            if (checkpoint.load(next_frame_idx, offset)) {
+                if (!ResultWriter::truncate(results, format, offset)) {
+                    cerr << results << " does not match its checkpoint: can not resume" << endl;
+                    return 1;
+                }
+                resumed = true;
+                pipeline.first_frame_idx = next_frame_idx;
+                cerr << "Resuming at frame " << next_frame_idx << endl;
+            }
+            else {
+                cerr << "No checkpoint for " << vm["video"].as<string>() << ": starting from the first frame" << endl;
+            }
+        }
+
+        ResultWriter writer(results, format, 1 << 16, resumed);
+        if (!writer.isOpen()) {
+            cerr << "Couldn't open " << results << endl;
+            return 1;
+        }
+
+        auto fps = video_in.get(cv::CAP_PROP_FPS);
+
+        auto t_start = getTickCount();
+
+        size_t next_frame_idx = pipeline.first_frame_idx;
+
+        auto nb_frames = pipeline.process(video_in, [&](const FrameResult& result) {
+            writer.write(result.frame_idx, fps > 0 ? result.frame_idx / fps : 0, result.poses,
+                         std::vector<uint32_t>(), "", result.features);
+            if (video_out.isOpened()) {
+                video_out.write(result.frame);
+            }
+
+            next_frame_idx = result.frame_idx + pipeline.stride;
+            if (results_to_file) checkpoint.update(next_frame_idx, writer);
+        });
+
+        writer.flush();
+        if (results_to_file) checkpoint.save(next_frame_idx, writer);
+
+        auto duration = (getTickCount() - t_start) / getTickFrequency();
+        cerr << "Processed " << nb_frames << " frames in " << duration << "s ("
+             << nb_frames / duration << " fps)" << endl;
+        return 0;
+    }
+
+    namedWindow("headpose");
+
+    // the camera is never sub-sampled
+    VideoSampler sampler(video_in);
+    if (vm.count("video")) {
+        sampler.stride = vm.count("rate") ? VideoSampler::strideForRate(video_in, vm["rate"].as<double>())
+                                          : vm["stride"].as<size_t>();
+    }
+
     while (true) {
-        auto ok = video_in.read(frame);
+        size_t frame_idx;
+        auto ok = sampler.read(frame, frame_idx);
         if (!ok) break;
 
         auto t_start = getTickCount();
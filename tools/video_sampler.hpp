@@ -0,0 +1,116 @@
+#ifndef __VIDEO_SAMPLER
+#define __VIDEO_SAMPLER
+
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+#include <opencv2/core/core.hpp>
+#ifdef OPENCV3
+#include <opencv2/videoio.hpp>
+#else
+#include <opencv2/highgui/highgui.hpp>
+#endif
+
+/** Reads one frame out of every `stride` frames of a video, without paying
+ * for the frames in between:
+ *
+ *  - frames close to the next sampled frame are only grabbed (they are not
+ *    converted nor copied);
+ *  - if the next sampled frame is at least `seek_min_stride` frames away, the
+ *    video is seeked instead, which lets the demuxer jump to the previous
+ *    keyframe and only decode from there. The typical H.264 keyframe interval
+ *    is 250 frames, hence the default value. Seeking is disabled if the
+ *    container does not support it.
+ */
+class VideoSampler {
+
+public:
+
+    VideoSampler(cv::VideoCapture& video, size_t stride = 1, size_t seek_min_stride = 250) :
+        stride(std::max<size_t>(stride, 1)),
+        seek_min_stride(seek_min_stride),
+        video(video),
+        next_frame_idx(0),
+        has_read(false)
+    {}
+
+    /** Returns the stride matching the given sampling rate (in Hz), based on
+     * the frame rate of the video (1 if unknown).
+     */
+    static size_t strideForRate(cv::VideoCapture& video, double rate)
+    {
+        auto fps = video.get(cv::CAP_PROP_FPS);
+        if (fps <= 0 || rate <= 0) return 1;
+        return std::max<size_t>(std::lround(fps / rate), 1);
+    }
+
+    /** Reads the next sampled frame, and sets `frame_idx` to its index in
+     * the video. Returns false at the end of the video.
+     */
+    bool read(cv::Mat& frame, size_t& frame_idx)
+    {
+        if (has_read && stride > 1) {
+            const size_t target_idx = next_frame_idx + stride - 1;
+
+            if (stride >= seek_min_stride) seek(target_idx);
+
+            // if the seek landed before the target (or did not happen at all)
+            while (next_frame_idx < target_idx) {
+                if (!video.grab()) return false;
+                next_frame_idx++;
+            }
+        }
+
+        if (!video.read(frame)) return false;
+
+        frame_idx = next_frame_idx++;
+        has_read = true;
+        return true;
+    }
+
+    /** Moves forward in the video, so that the next read() returns the
+     * frame `frame_idx` (sampling then goes on from there). Returns false at
+     * the end of the video.
+     */
+    bool skipTo(size_t frame_idx)
+    {
+        // (seek_min_stride is SIZE_MAX once seeking failed: no overflow)
+        if (frame_idx > next_frame_idx && frame_idx - next_frame_idx >= seek_min_stride) seek(frame_idx);
+
+        while (next_frame_idx < frame_idx) {
+            if (!video.grab()) return false;
+            next_frame_idx++;
+        }
+
+        has_read = false;
+        return true;
+    }
+
+    size_t stride;
+    size_t seek_min_stride;
+
+private:
+
+    /** Seeks to the given frame, and updates next_frame_idx with the
+     * position the video actually landed on. Disables seeking if the video
+     * does not support it.
+     */
+    void seek(size_t target_idx)
+    {
+        if (!video.set(cv::CAP_PROP_POS_FRAMES, target_idx)) {
+            seek_min_stride = std::numeric_limits<size_t>::max();
+            return;
+        }
+
+        auto position = video.get(cv::CAP_PROP_POS_FRAMES);
+        if (position >= 0) next_frame_idx = std::lround(position);
+    }
+
+    cv::VideoCapture& video;
+
+    size_t next_frame_idx; // index of the next frame to be read in the video
+    bool has_read;         // false until the first frame is read (or after skipTo())
+};
+
+#endif // __VIDEO_SAMPLER